@@ -23,7 +23,7 @@
 #include "sdyn/value.h"
 
 /* execute this code */
-void sdyn_exec(const unsigned char *code)
+void sdyn_exec(const unsigned char *code, int permanent)
 {
     SDyn_Node pnode = NULL, cnode = NULL;
     SDyn_NodeArray children = NULL;
@@ -35,6 +35,7 @@ void sdyn_exec(const unsigned char *code)
 
     /* parse it */
     pnode = sdyn_parse(code);
+    if (permanent) pnode = sdyn_permanentNode(pnode);
     children = GGC_RP(pnode, children);
 
     /* load everything in */
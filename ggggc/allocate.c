@@ -186,10 +186,56 @@ struct GGGGC_Array {
     ggc_size_t length;
 };
 
+/* make a descriptor we keep forever a root, unless it's in permanent space,
+ * which the collector might not have */
+static void keepDescriptor(struct GGGGC_Descriptor **descriptor)
+{
+    if (ggggc_isPermanent(*descriptor)) return;
+    GGC_PUSH_1(*descriptor);
+    GGC_GLOBALIZE();
+}
+
+/* get a shared array descriptor of the given size, from the given cache,
+ * allocating it with the given allocator if needed */
+static struct GGGGC_Descriptor *getArrayDescriptor(
+    struct GGGGC_Descriptor **cache, ggc_size_t size,
+    struct GGGGC_Descriptor *(*allocator)(ggc_size_t, int))
+{
+    struct GGGGC_Descriptor *ret;
+
+    /* large arrays are rare enough to get their own */
+    if (size >= GGGGC_ARRAY_DESCRIPTORS)
+        return allocator(size, 0);
+
+    /* check if we already have a descriptor */
+    if (cache[size])
+        return cache[size];
+
+    /* otherwise, need to allocate one, then check that nobody beat us to it.
+     * Cached descriptors are kept forever, so they're permanent. */
+    ret = allocator(size, 1);
+    ggc_mutex_lock_raw(&ggggc_descriptorDescriptorsLock);
+    if (cache[size]) {
+        ret = cache[size];
+        ggc_mutex_unlock(&ggggc_descriptorDescriptorsLock);
+        return ret;
+    }
+    cache[size] = ret;
+    ggc_mutex_unlock(&ggggc_descriptorDescriptorsLock);
+    keepDescriptor(&cache[size]);
+
+    return ret;
+}
+
+static struct GGGGC_Descriptor *allocateDescriptorPA(ggc_size_t size, int permanent);
+static struct GGGGC_Descriptor *allocateDescriptorDA(ggc_size_t size, int permanent);
+
 /* allocate a pointer array (size is in words) */
 void *ggggc_mallocPointerArray(ggc_size_t sz)
 {
-    struct GGGGC_Descriptor *descriptor = ggggc_allocateDescriptorPA(sz + 1 + sizeof(struct GGGGC_Header)/sizeof(ggc_size_t));
+    struct GGGGC_Descriptor *descriptor = getArrayDescriptor(ggggc_descriptorsPA,
+        sz + 1 + sizeof(struct GGGGC_Header)/sizeof(ggc_size_t),
+        allocateDescriptorPA);
     struct GGGGC_Array *ret = (struct GGGGC_Array *) ggggc_malloc(descriptor);
     ret->length = sz;
     return ret;
@@ -199,7 +245,9 @@ void *ggggc_mallocPointerArray(ggc_size_t sz)
 void *ggggc_mallocDataArray(ggc_size_t nmemb, ggc_size_t size)
 {
     ggc_size_t sz = ((nmemb*size)+sizeof(ggc_size_t)-1)/sizeof(ggc_size_t);
-    struct GGGGC_Descriptor *descriptor = ggggc_allocateDescriptorDA(sz + 1 + sizeof(struct GGGGC_Header)/sizeof(ggc_size_t));
+    struct GGGGC_Descriptor *descriptor = getArrayDescriptor(ggggc_descriptorsDA,
+        sz + 1 + sizeof(struct GGGGC_Header)/sizeof(ggc_size_t),
+        allocateDescriptorDA);
     struct GGGGC_Array *ret = (struct GGGGC_Array *) ggggc_malloc(descriptor);
     ret->length = nmemb;
     return ret;
@@ -229,8 +277,9 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorDescriptor(ggc_size_t size)
         return ggggc_descriptorDescriptors[size];
     }
 
-    /* allocate the descriptor descriptor */
-    ret = (struct GGGGC_Descriptor *) ggggc_mallocRaw(&ddd, ddSize);
+    /* allocate the descriptor descriptor. They're never freed, so they go
+     * in permanent space */
+    ret = (struct GGGGC_Descriptor *) ggggc_mallocRawPermanent(&ddd, ddSize);
 
     /* make it correct */
     if (ddSize != size)
@@ -243,8 +292,7 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorDescriptor(ggc_size_t size)
     /* put it in the list */
     ggggc_descriptorDescriptors[size] = ret;
     ggc_mutex_unlock(&ggggc_descriptorDescriptorsLock);
-    GGC_PUSH_1(ggggc_descriptorDescriptors[size]);
-    GGC_GLOBALIZE();
+    keepDescriptor(&ggggc_descriptorDescriptors[size]);
 
     return ret;
 }
@@ -258,9 +306,8 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptor(ggc_size_t size, ggc_size_t po
     return ggggc_allocateDescriptorL(size, pointersA);
 }
 
-/* descriptor allocator when more than one word is required to describe the
- * pointers */
-struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_size_t *pointers)
+/* allocate a descriptor, in permanent space if asked */
+static struct GGGGC_Descriptor *allocateDescriptor(ggc_size_t size, const ggc_size_t *pointers, int permanent)
 {
     struct GGGGC_Descriptor *dd, *ret;
     ggc_size_t dPWords, dSize;
@@ -276,7 +323,10 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_si
     dd = ggggc_allocateDescriptorDescriptor(dSize);
 
     /* use that to allocate the descriptor */
-    ret = (struct GGGGC_Descriptor *) ggggc_mallocRaw(&dd, dd->size);
+    if (permanent)
+        ret = (struct GGGGC_Descriptor *) ggggc_mallocRawPermanent(&dd, dd->size);
+    else
+        ret = (struct GGGGC_Descriptor *) ggggc_mallocRaw(&dd, dd->size);
     ret->header.descriptor__ptr = dd;
     ret->size = size;
 
@@ -291,8 +341,21 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_si
     return ret;
 }
 
+/* descriptor allocator when more than one word is required to describe the
+ * pointers */
+struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_size_t *pointers)
+{
+    return allocateDescriptor(size, pointers, 0);
+}
+
+/* the same, for a descriptor that will never be freed */
+struct GGGGC_Descriptor *ggggc_allocatePermanentDescriptorL(ggc_size_t size, const ggc_size_t *pointers)
+{
+    return allocateDescriptor(size, pointers, 1);
+}
+
 /* descriptor allocator for pointer arrays */
-struct GGGGC_Descriptor *ggggc_allocateDescriptorPA(ggc_size_t size)
+static struct GGGGC_Descriptor *allocateDescriptorPA(ggc_size_t size, int permanent)
 {
     ggc_size_t *pointers;
     ggc_size_t dPWords, i;
@@ -312,19 +375,31 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorPA(ggc_size_t size)
     pointers[0] &= ~((ggc_size_t)1<<(((ggc_size_t) (void *) &((struct GGGGC_Header *) 0)->ggggc_memoryCorruptionCheck)/sizeof(ggc_size_t)));
     #endif
     /* and allocate */
-    return ggggc_allocateDescriptorL(size, pointers);
+    return allocateDescriptor(size, pointers, permanent);
+}
+
+struct GGGGC_Descriptor *ggggc_allocateDescriptorPA(ggc_size_t size)
+{
+    return allocateDescriptorPA(size, 0);
 }
 
 /* descriptor allocator for data arrays */
-struct GGGGC_Descriptor *ggggc_allocateDescriptorDA(ggc_size_t size)
+static struct GGGGC_Descriptor *allocateDescriptorDA(ggc_size_t size, int permanent)
 {
     /* and allocate */
-    return ggggc_allocateDescriptorL(size, NULL);
+    return allocateDescriptor(size, NULL, permanent);
+}
+
+struct GGGGC_Descriptor *ggggc_allocateDescriptorDA(ggc_size_t size)
+{
+    return allocateDescriptorDA(size, 0);
 }
 
 /* allocate a descriptor from a descriptor slot */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorSlot(struct GGGGC_DescriptorSlot *slot)
 {
+    ggc_size_t pointers[1];
+
     if (slot->descriptor) return slot->descriptor;
     ggc_mutex_lock_raw(&slot->lock);
     if (slot->descriptor) {
@@ -332,12 +407,12 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorSlot(struct GGGGC_DescriptorSlo
         return slot->descriptor;
     }
 
-    slot->descriptor = ggggc_allocateDescriptor(slot->size, slot->pointers);
+    /* types live as long as the program, so their descriptors are
+     * permanent */
+    pointers[0] = slot->pointers;
+    slot->descriptor = allocateDescriptor(slot->size, pointers, 1);
     ggc_mutex_unlock(&slot->lock);
-
-    /* make the slot descriptor a root */
-    GGC_PUSH_1(slot->descriptor);
-    GGC_GLOBALIZE();
+    keepDescriptor(&slot->descriptor);
 
     return slot->descriptor;
 }
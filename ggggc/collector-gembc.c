@@ -61,13 +61,15 @@ static struct GGGGC_Pool *newPoolGenProto(struct GGGGC_Pool *proto) {
 #endif
 }
 
-/* NOTE: there is code duplication between ggggc_malloc and ggggc_mallocGen1
+static void collect0(unsigned char gen);
+
+/* NOTE: there is code duplication between mallocRaw and ggggc_mallocGen1
  * because I can't trust a compiler to inline and optimize for the 0 case */
 
 /* allocate an object in generation 0 */
-void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to protect, if applicable */
-                      ggc_size_t size /* size of object to allocate */
-                      ) {
+static void *mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to protect, if applicable */
+                       ggc_size_t size /* size of object to allocate */
+                       ) {
     struct GGGGC_Pool *pool;
     struct GGGGC_Header *ret;
 
@@ -98,10 +100,17 @@ retry:
         ggggc_pool0 = pool = pool->next;
         goto retry;
 
+    } else if (size > (ggc_size_t) (pool->end - pool->start)) {
+        /* no collection will make room for this, and we have no large
+         * object space to put it in */
+        fprintf(stderr, "GGGGC: object of %lu words is too large for a pool\n",
+            (unsigned long) size);
+        abort();
+
     } else {
         /* need to collect, which means we need to actually be a GC-safe function */
         GGC_PUSH_1(*descriptor);
-        ggggc_collect0(0);
+        collect0(0);
         GGC_POP();
         pool = ggggc_pool0;
         goto retry;
@@ -160,15 +169,6 @@ retry:
 }
 #endif
 
-/* allocate an object */
-void *ggggc_malloc(struct GGGGC_Descriptor *descriptor)
-{
-    struct GGGGC_Header *ret = (struct GGGGC_Header *) ggggc_mallocRaw(&descriptor, descriptor->size);
-    ret->descriptor__ptr = descriptor;
-    return ret;
-}
-
-
 /* full collection */
 void ggggc_collectFull(void);
 
@@ -365,7 +365,7 @@ static void report(unsigned char gen, const char *when)
 #endif
 
 /* run a generation 0 collection */
-void ggggc_collect0(unsigned char gen)
+static void collect0(unsigned char gen)
 {
     struct GGGGC_PoolList pool0Node, *plCur;
     struct GGGGC_Pool *poolCur;
@@ -373,6 +373,7 @@ void ggggc_collect0(unsigned char gen)
     struct GGGGC_JITPointerStackList jitPointerStackNode, *jpslCur;
     struct GGGGC_PointerStack *psCur;
     void **jpsCur;
+    struct GGGGC_JITStackWalk jitWalk;
     struct ToSearch *toSearch;
     unsigned char genCur;
     ggc_size_t i;
@@ -443,7 +444,7 @@ collect:
         }
     }
     for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
+        for (jpsCur = ggggc_jitStackFirst(&jitWalk, jpslCur); jpsCur; jpsCur = ggggc_jitStackNext(&jitWalk)) {
             TOSEARCH_ADD(jpsCur);
         }
     }
@@ -704,6 +705,7 @@ void ggggc_collectFull()
     struct GGGGC_PointerStack *psCur;
     struct GGGGC_JITPointerStackList *jpslCur;
     void **jpsCur;
+    struct GGGGC_JITStackWalk jitWalk;
     struct ToSearch *toSearch;
     unsigned char genCur;
     ggc_size_t i;
@@ -719,7 +721,7 @@ void ggggc_collectFull()
         }
     }
     for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
+        for (jpsCur = ggggc_jitStackFirst(&jitWalk, jpslCur); jpsCur; jpsCur = ggggc_jitStackNext(&jitWalk)) {
             TOSEARCH_ADD(jpsCur);
         }
     }
@@ -792,7 +794,7 @@ void ggggc_collectFull()
         }
     }
     for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
+        for (jpsCur = ggggc_jitStackFirst(&jitWalk, jpslCur); jpsCur; jpsCur = ggggc_jitStackNext(&jitWalk)) {
             if (*jpsCur)
                 FOLLOW_COMPACTED_OBJECT(*jpsCur);
         }
@@ -895,7 +897,7 @@ void ggggc_compact(struct GGGGC_Pool *pool)
 {
     ggc_size_t chSize, fchSize;
     struct BreakTableEl *bt = NULL, *btEnd;
-    ggc_size_t i, j, *cur;
+    ggc_size_t i, *cur;
 
     /* ggggc_countUsed put the size of the first contiguous chunk in breakTableSize, so start from there */
     cur = pool->start + pool->breakTableSize;
@@ -919,14 +921,17 @@ void ggggc_compact(struct GGGGC_Pool *pool)
         else
             fchSize = 0;
 
-        /* now copy in the data while rolling forward the bt */
-        for (i = 0; i < chSize; i += sizeof(struct BreakTableEl) / sizeof(ggc_size_t)) {
+        /* now copy in the data while rolling forward the bt. Entries are only
+         * moved when the data reaches them, so that odd-sized chunks don't
+         * push the bt forward more than the data, until it runs off the end
+         * of the pool. */
+        for (i = 0; i < chSize; i++) {
             /* move the bt entry out of the way */
-            *btEnd++ = *bt++;
+            if (pool->free + i >= (ggc_size_t *) bt)
+                *btEnd++ = *bt++;
 
             /* and copy in the data */
-            for (j = 0; j < sizeof(struct BreakTableEl) / sizeof(ggc_size_t); j++)
-                pool->free[i+j] = cur[i+j];
+            pool->free[i] = cur[i];
         }
 
         /* add the bt table entry */
@@ -1041,7 +1046,7 @@ void ggggc_postCompact(struct GGGGC_Pool *pool)
 }
 
 /* explicitly yield to the collector */
-int ggggc_yield()
+static int yield()
 {
     struct GGGGC_PoolList pool0Node;
     struct GGGGC_PointerStackList pointerStackNode;
@@ -1078,6 +1083,19 @@ int ggggc_yield()
     return 0;
 }
 
+/* gembc compacts, so it has no permanent space, and it can't walk its heap */
+const struct GGGGC_Collector ggggc_collectorGembc = {
+    "gembc",
+    0,
+    mallocRaw,
+    collect0,
+    yield,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
 #ifdef __cplusplus
 }
 #endif
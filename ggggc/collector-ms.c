@@ -1,33 +1,94 @@
+#define _DEFAULT_SOURCE /* for MAP_ANON */
+#define _BSD_SOURCE /* for MAP_ANON on older glibc */
+#define _DARWIN_C_SOURCE /* for MAP_ANON on OS X */
+
 #include "ggggc/gc.h"
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if GGGGC_THREADS_POSIX
+#include <sched.h>
+#endif
 
 #include "ggggc-internals.h"
 
-void ggggc_collect0(unsigned char gen);
+static void collect(unsigned char gen, enum GGGGC_CollectionReason reason);
+static int isPermanent(void *ptr);
 void pointerStackDump();
 
 /*
     This is my own Pool structure.
+    cards:  the card table, one byte per card, set by the write barrier
+            (GGGGC_WP) when an old object whose header is on the card is
+            written
+    markBits:   the mark bitmap, with one bit for every word in the pool
     next:   a pointer to the next pool
-    freelist:   a pointer to the first free object in this pool
     endptr: a pointer to the first available (unallocated) word in this pool
     memSpace:   a pointer to the first word that can be given to the mutator
+    Free space below endptr is kept in the heap-level free lists, not per pool.
 */
+#define MARK_WORDS (GGGGC_WORDS_PER_POOL / GGGGC_BITS_PER_WORD)
 struct Pool{
+    // the barrier finds these two by their offsets; see GGGGC_CARD_TABLE
+    unsigned char cards[GGGGC_CARDS_PER_POOL];
+    ggc_size_t markBits[MARK_WORDS];
     struct Pool *next;
-    struct FreeObjHeader *freelist;
     ggc_size_t * endptr;  // end of used memory space
     ggc_size_t memSpace[];
 };
 
 // The real pool size (excluding the pool header)
-#define POOL_SIZE ((GGGGC_POOL_BYTES) - 3 * sizeof(void *))
-// 3 constants for managing GC frequency
-#define LOAD_IDEAL 0.4
+#define POOL_SIZE ((GGGGC_POOL_BYTES) - sizeof(struct Pool))
+
+/*
+    Objects of LARGE_OBJECT_WORDS or more don't go in pools. Each gets a
+    mapping of its own, aligned like a pool so that POOL_OF finds its header.
+    The header starts with a card table and a mark bitmap at the same offsets
+    as a pool's, so marking and the write barrier treat it just the same.
+    Only the mark bit of the object itself is ever used, so the bitmap only
+    has to reach that far. Large objects are unmapped as soon as they're found
+    dead.
+*/
+#define LARGE_OBJECT_WORDS (128 * 1024 / sizeof(ggc_size_t))
+#define LARGE_MARK_WORDS 16
+struct LargeObject{
+    unsigned char cards[GGGGC_CARDS_PER_POOL];
+    ggc_size_t markBits[LARGE_MARK_WORDS];
+    struct LargeObject *next;
+    ggc_size_t bytes;   // size of the mapping
+    ggc_size_t memSpace[];
+};
+// The heap is sized by sizeHeap. By default, it aims to spend this share of
+// the time collecting
+#define GC_OVERHEAD 0.05
+// but always leaves free at least FREE_MIN and at most FREE_MAX times as much
+// as survived the last collection
+#define FREE_MIN 0.25
+#define FREE_MAX 8
+// and only gives pools back once it's SHRINK_SLACK times the size it wants
+#define SHRINK_SLACK 1.5
+// The load factor at which ggggc_yield collects
 #define LOAD_COLLECT 0.8
-#define LOAD_EXPAND 0.7
+// When marking incrementally, the load factor at which to start
+#define LOAD_MARK 0.75
+// and how many words to allocate between slices of marking
+#define MARK_SLICE_WORDS 16384
+// How much the old objects may grow between major collections
+#define MAJOR_GROWTH 2
+// and how many minor collections may run before a major one, so that old
+// garbage is found (and its pools given back) even if nothing else grows
+#define MAJOR_INTERVAL 16
+// Free blocks smaller than FRAGMENT_WORDS are too small for most of what SDyn
+// allocates, and once they're this share of the heap, it's compacted (see
+// compactHeap)
+#define FRAGMENT_WORDS 8
+#define FRAGMENTATION 0.1
 
 /*
     This is the header for free objects, i.e. free memory blocks.
@@ -36,8 +97,8 @@ struct Pool{
     while here the first word is a pointer to the next free object.
     Since the first word is used as a pointer in both structures,
     we can use its least significant bits to mark it.
-    Bit 0x1 is used to mark the objects during GC.
-        Bit 0x1 is set -- object is marked
+    Bit 0x1 is unused; mark bits are kept in the pool's markBits instead, so
+    the sweep never has to touch dead objects.
     Bit 0x2 is used to differentiate a free object from an alive object.
         Bit 0x2 is set -- this object is a free object
     For alive objects, the first word is a valid pointer.
@@ -54,16 +115,94 @@ struct FreeObjHeader{
 // Size of the larger header
 #define HEADER_SIZE (sizeof(struct FreeObjHeader) > sizeof(struct GGGGC_Header) ? \
 sizeof(struct FreeObjHeader) : sizeof(struct GGGGC_Header))
+// The smallest block we can allocate or put on a free list, in words
+#define MIN_BLOCK (HEADER_SIZE / sizeof(ggc_size_t))
+
+/*
+    Free blocks are kept in segregated free lists shared by the whole heap.
+    A block of n words, for n < SIZE_CLASSES - 1, lives in freeLists[n], so
+    the small sizes SDyn allocates most are an exact pop. Larger blocks all
+    share the last list, which is searched first-fit.
+    Bit n of freeListsUsed is set exactly when freeLists[n] is nonempty, so
+    the smallest list worth splitting can be found without a walk.
+    Free memory is kept zeroed, but for the header of each free block, so
+    allocation only has to clear that header. Pools come zeroed from the OS,
+    so the space past a pool's endptr always is, and the sweep zeroes what
+    it frees in bulk (see sweepPool).
+*/
+#define SIZE_CLASSES GGGGC_BITS_PER_WORD
+#define LARGE_CLASS (SIZE_CLASSES - 1)
+static struct FreeObjHeader *freeLists[SIZE_CLASSES];
+static ggc_size_t freeListsUsed = 0;
+// Words and blocks on the free lists, for the statistics
+static ggc_size_t freeListWords = 0;
+static ggc_size_t freeListBlocks = 0;
+// and words on them in blocks smaller than FRAGMENT_WORDS
+static ggc_size_t fragmentWords = 0;
 
 // Some static global variables
 // For maintaining the linked list of pools
+// Pools after currentPool have never been allocated from, so currentPool and
+// the pools after it are the only ones with space not on the free lists
 static struct Pool *poolList = NULL;
 static struct Pool *currentPool = NULL;
 static struct Pool *lastPool = NULL;
-// For calculating load factor
+// The large objects, and the words put in them since the last collection
+static struct LargeObject *largeObjects = NULL;
+static ggc_size_t largeAllocated = 0;
+// Pools from sweepNext up to (but not including) sweepEnd are still to be
+// swept since the last collection
+static struct Pool *sweepNext = NULL;
+static struct Pool *sweepEnd = NULL;
+// and the last pool swept and kept, for unlinking the ones given back
+static struct Pool *sweepPrev = NULL;
+// Words allocated (counting survivors of the last collection as allocated),
+// and words in the pools. allocated / available is the load factor, but it's
+// only ever compared with precomputed thresholds (see setThresholds).
 static ggc_size_t allocated = 0;
 static ggc_size_t available = 0;
-static double loadFactor = 0;
+static ggc_size_t collectAt = 0;
+static ggc_size_t markAt = 0;
+// Heap sizing (see sizeHeap): the size it wants the heap to be, the most it
+// may be (0 for no limit), and the share of time to spend collecting, or -1
+// until we've read the environment. All sizes are in words.
+static ggc_size_t heapTarget = 0;
+static ggc_size_t heapLimit = 0;
+static double gcOverhead = -1;
+// The share of the heap in fragments at which to compact it
+static double fragmentation = FRAGMENTATION;
+// Whether the heap is big enough that empty pools should be given back
+static int shrinking = 0;
+// When the last collection ended, allocated as of then, and time spent on
+// incremental marking since
+static unsigned long long lastCollectionEnd = 0;
+static ggc_size_t lastAllocated = 0;
+static unsigned long long sliceNs = 0;
+// Live words found so far by marking
+static ggc_size_t markedWords = 0;
+// Words in old objects, as of the last collection, and as of the last major
+// collection (or the first collection, which marks everything anyway)
+static ggc_size_t oldWords = 0;
+static ggc_size_t majorOldWords = 0;
+// Minor collections since the last major one
+static unsigned int minorCount = 0;
+// Incremental marking (see markSlice): the pause target in nanoseconds, 0 to
+// collect all at once, or -1 until we've read the environment
+static long long pauseTarget = -1;
+// Words allocated since the last slice of marking
+static ggc_size_t sliceAllocated = 0;
+// Statistics (see ggggc_getStats), roots pushed since the last collection,
+// bytes mapped for large objects, and who to tell about each collection
+static struct GGGGC_Stats stats;
+static ggc_size_t rootsScanned = 0;
+static ggc_size_t largeBytes = 0;
+static ggggc_collection_hook_t collectionHook = NULL;
+// Allocation sampling (see sampleAllocation): bytes left until the next
+// sample, the mean interval, and who to tell
+static long sampleCountdown = LONG_MAX;
+static ggc_size_t sampleInterval = 0;
+static unsigned long sampleSeed = 88172645463325252UL;
+static ggggc_allocation_hook_t allocationHook = NULL;
 // This program talks a lot when the CHATTY switch is turned on
 #ifdef CHATTY
 static int poolCount = 0;
@@ -81,49 +220,149 @@ static inline void assertPtrAligned(void *ptr){
 
 // Mask out the flags and cast it to a pointer
 // -- for convenience, since we only set flags on pointers
-inline ggc_size_t * maskMarks(ggc_size_t val){
+static inline ggc_size_t * maskMarks(ggc_size_t val){
     val &= (~0x3);
     return (ggc_size_t *)val;
 }
 
-// Mark a word (0x1)
-inline void markPointed(ggc_size_t *pos){
-    *pos |= 0x1;
-}
-
-// Erase the mark on a word (0x1)
-inline void unmarkPointed(ggc_size_t *pos){
-    *pos &= (~0x1);
-}
-
 // Mark a word (0x2)
-inline void markFree(ggc_size_t *pos){
+static inline void markFree(ggc_size_t *pos){
     *pos |= 0x2;
 }
 
 // Erase the mark on a word (0x2)
-inline void unmarkFree(ggc_size_t *pos){
+static inline void unmarkFree(ggc_size_t *pos){
     *pos &= (~0x2);
 }
 
-// Test the flag (0x1)
-inline int testPointed(ggc_size_t *pos){
-    return (*pos) & 0x1;
-}
-
 // Test the flag (0x2)
-inline int testFree(ggc_size_t *pos){
+static inline int testFree(ggc_size_t *pos){
     return (*pos) & 0x2;
 }
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+// The pool containing this object, and the index of its mark bit there
+#define POOL_OF(ptr) ((struct Pool *)((ggc_size_t)(ptr) & GGGGC_POOL_OUTER_MASK))
+#define MARK_INDEX(ptr) (((ggc_size_t)(ptr) & GGGGC_POOL_INNER_MASK) / sizeof(ggc_size_t))
+
+// Test the mark bit of an object
+static inline int testMarked(ggc_size_t *obj){
+    ggc_size_t idx = MARK_INDEX(obj);
+    return (POOL_OF(obj)->markBits[idx / GGGGC_BITS_PER_WORD] >> (idx % GGGGC_BITS_PER_WORD)) & 1;
+}
+
+// Set the mark bit of an object, returning 0 if it was already set. Parallel
+// markers can race for the same object, so this is atomic.
+static inline int tryMark(ggc_size_t *obj){
+    ggc_size_t idx = MARK_INDEX(obj);
+    ggc_size_t *word = &POOL_OF(obj)->markBits[idx / GGGGC_BITS_PER_WORD];
+    ggc_size_t bit = (ggc_size_t)1 << (idx % GGGGC_BITS_PER_WORD);
+    if(*word & bit){
+        return 0;
+    }
+    return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+}
+
+// The free list a block of this many words belongs in
+static inline ggc_size_t sizeClass(ggc_size_t size){
+    return size < LARGE_CLASS ? size : LARGE_CLASS;
+}
+
+// Turn a block of memory into a free object and put it on its free list
+static inline void pushFree(ggc_size_t *block, ggc_size_t size){
+    struct FreeObjHeader *header = (struct FreeObjHeader *)block;
+    ggc_size_t sc = sizeClass(size);
+    header->next = freeLists[sc];
+    header->size = size;
+    markFree(block);
+    freeLists[sc] = header;
+    freeListsUsed |= (ggc_size_t)1 << sc;
+    freeListWords += size;
+    ++freeListBlocks;
+    if(size < FRAGMENT_WORDS){
+        fragmentWords += size;
+    }
+}
+
+// Take the first block off a nonempty free list
+static inline ggc_size_t *popFree(ggc_size_t sc){
+    struct FreeObjHeader *header = freeLists[sc];
+    freeLists[sc] = (struct FreeObjHeader *)maskMarks((ggc_size_t)(header->next));
+    if(!freeLists[sc]){
+        freeListsUsed &= ~((ggc_size_t)1 << sc);
+    }
+    freeListWords -= header->size;
+    --freeListBlocks;
+    if(header->size < FRAGMENT_WORDS){
+        fragmentWords -= header->size;
+    }
+    return (ggc_size_t *)header;
+}
+
+// Find a free block of exactly size words, splitting a larger one if needed.
+// Returns NULL if there is none.
+static ggc_size_t *allocFree(ggc_size_t size){
+    ggc_size_t *block;
+    ggc_size_t candidates, sc;
+    struct FreeObjHeader *prev, *p;
+
+    // exact fit
+    if(size < LARGE_CLASS && freeLists[size]){
+        return popFree(size);
+    }
+
+    // split the smallest small block that leaves a usable remainder
+    if(size + MIN_BLOCK < LARGE_CLASS){
+        candidates = freeListsUsed & ~(((ggc_size_t)1 << (size + MIN_BLOCK)) - 1) &
+            ~((ggc_size_t)1 << LARGE_CLASS);
+        if(candidates){
+            sc = __builtin_ctzl(candidates);
+            block = popFree(sc);
+            pushFree(block + size, sc - size);
+            return block;
+        }
+    }
+
+    // first fit among the large blocks
+    for(prev = NULL, p = freeLists[LARGE_CLASS]; p;
+        prev = p, p = (struct FreeObjHeader *)maskMarks((ggc_size_t)(p->next))){
+        #ifdef GUARD
+        if(!testFree((ggc_size_t *)p)){
+            printf("Object on free list not marked as free\n");
+            abort();
+        }
+        #endif
+        if(p->size == size || p->size >= size + MIN_BLOCK){
+            // unlink it
+            if(prev){
+                prev->next = p->next;   // keeps the free mark
+            }
+            else{
+                freeLists[LARGE_CLASS] = (struct FreeObjHeader *)maskMarks((ggc_size_t)(p->next));
+                if(!freeLists[LARGE_CLASS]){
+                    freeListsUsed &= ~((ggc_size_t)1 << LARGE_CLASS);
+                }
+            }
+            freeListWords -= p->size;
+            --freeListBlocks;
+            // and give back what we don't need
+            block = (ggc_size_t *)p;
+            if(p->size != size){
+                pushFree(block + size, p->size - size);
+            }
+            return block;
+        }
+    }
+
+    return NULL;
+}
+
 #ifdef CHATTY
 // Debug function; Prints the allocated part of a pool
 void poolDump(struct Pool *p){
     printf("===Pool dump===\n");
     printf("Next pool pointer: %p\n", p->next);
-    printf("Free list pointer: %p\n", p->freelist);
     printf("Occupied space: [%p, %p)\n", p, (unsigned char *)p + GGGGC_POOL_BYTES);
     printf("Visible space: [%p, %p)\n", p->memSpace, (unsigned char *)(p->memSpace) + POOL_SIZE);
     printf("Allocated space: [%p, %p)\n", p->memSpace, p->endptr);
@@ -172,7 +411,7 @@ void objDump(struct GGGGC_Header *header){
 // Debug function; Dumps all pools and root pointers
 void fullDump(){
     printf("=====Full heap dump=====\n");
-    printf("Global load factor: %lf\n", loadFactor);
+    printf("Global load factor: %lf\n", allocated / (double)available);
     for(struct Pool *p = poolList; p; p = p->next){
         poolDump(p);
     }
@@ -181,17 +420,22 @@ void fullDump(){
     printf("=====End=====\n");
 }
 
-// Debug function; Prints all free list entries in a pool
-void freeListDump(struct Pool *pool){
-    struct FreeObjHeader *header = pool->freelist;
-    printf("*** Freelist of pool %p:\n", pool);
-    while(header){
-        if(!testFree(header)){
-            printf("Object on free list not marked as free\n");
-            abort();
+// Debug function; Prints all free list entries
+void freeListDump(){
+    for(ggc_size_t sc = 0; sc < SIZE_CLASSES; ++sc){
+        struct FreeObjHeader *header = freeLists[sc];
+        if(!header){
+            continue;
+        }
+        printf("*** Freelist of size class %lu:\n", sc);
+        while(header){
+            if(!testFree((ggc_size_t *)header)){
+                printf("Object on free list not marked as free\n");
+                abort();
+            }
+            printf("%p (%lu words)\n", header, header->size);
+            header = (struct FreeObjHeader *)maskMarks((ggc_size_t)(header->next));
         }
-        printf("%p\n", header);
-        header = maskMarks((ggc_size_t)(header->next));
     }
     printf("***End\n");
 }
@@ -209,6 +453,14 @@ static inline void assertHeapPointer(void * ptr){
             return;
         }
     }
+    for(struct LargeObject *lo = largeObjects; lo; lo = lo->next){
+        if((struct Pool *)lo == poolptr){
+            return;
+        }
+    }
+    if(isPermanent(ptr)){
+        return;
+    }
     abort();
 }
 
@@ -218,15 +470,15 @@ static void assertParsableHeap(){
     for(struct Pool *pool = poolList; pool; pool = pool->next){
         ggc_size_t *objPointer = pool->memSpace;
         while(objPointer != pool->endptr){
-            if(testPointed(objPointer)){
-                printf("Pointer should not be marked\n");
-                abort();
-            }
             if(objPointer > pool->endptr){
                 printf("Heap parsability lost\n");
                 abort();
             }
             if(testFree(objPointer)){
+                if(testMarked(objPointer)){
+                    printf("Free block should not be marked\n");
+                    abort();
+                }
                 objPointer += ((struct FreeObjHeader *)objPointer)->size;
             }
             else{
@@ -238,19 +490,167 @@ static void assertParsableHeap(){
 }
 #endif
 
+/*
+    The heap is sized to spend about gcOverhead of the time collecting. A
+    collection that took t, after the mutator allocated at a rate of r, will
+    come around again after f / r if the heap has f words free, so the heap
+    wants f = t * r * (1 - gcOverhead) / gcOverhead words free on top of what
+    survived. That's kept between FREE_MIN and FREE_MAX times what survived,
+    and averaged with the last size so that one odd collection doesn't throw
+    it. The heap grows to it after every collection, and never past
+    heapLimit. GGGGC_GC_OVERHEAD (as a percentage) and GGGGC_MAX_HEAP (in
+    bytes, with an optional K, M or G) set these from the environment, and
+    ggggc_setHeapPolicy from the program. GGGGC_FRAGMENTATION (also a
+    percentage) sets how fragmented the heap may get before it's compacted.
+*/
+static unsigned long long nowNs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Precompute the allocation thresholds for this heap size
+static void setThresholds(){
+    collectAt = LOAD_COLLECT * available;
+    markAt = LOAD_MARK * available;
+}
+
+// Read GGGGC_GC_OVERHEAD, GGGGC_MAX_HEAP and GGGGC_FRAGMENTATION
+static void initHeapPolicy(){
+    const char *env;
+    char *end;
+    ggc_size_t limit;
+    gcOverhead = GC_OVERHEAD;
+    env = getenv("GGGGC_GC_OVERHEAD");
+    if(env && atof(env) > 0 && atof(env) < 100){
+        gcOverhead = atof(env) / 100;
+    }
+    env = getenv("GGGGC_MAX_HEAP");
+    if(env){
+        limit = strtoull(env, &end, 10);
+        switch(*end){
+            case 'g': case 'G': limit *= 1024; /* fall through */
+            case 'm': case 'M': limit *= 1024; /* fall through */
+            case 'k': case 'K': limit *= 1024;
+        }
+        heapLimit = limit / sizeof(ggc_size_t);
+    }
+    env = getenv("GGGGC_FRAGMENTATION");
+    if(env && atof(env) > 0 && atof(env) <= 100){
+        fragmentation = atof(env) / 100;
+    }
+}
+
+/* set the maximum heap size in bytes (0 for none) and the share of time to
+ * spend collecting (0 to keep the current one) */
+void ggggc_setHeapPolicy(ggc_size_t maxHeap, double overhead)
+{
+    if(gcOverhead < 0){
+        initHeapPolicy();
+    }
+    heapLimit = maxHeap / sizeof(ggc_size_t);
+    if(overhead > 0 && overhead < 1){
+        gcOverhead = overhead;
+    }
+}
+
+// Choose heapTarget after a collection that took gcNs, leaving live words
+static void sizeHeap(unsigned long long gcNs, ggc_size_t live){
+    unsigned long long now = nowNs();
+    unsigned long long mutatorNs = now - lastCollectionEnd;
+    double rate, free;
+    ggc_size_t target;
+
+    mutatorNs = mutatorNs > gcNs ? mutatorNs - gcNs : 1;
+    rate = (allocated - lastAllocated) / (double)mutatorNs;
+    free = gcNs * rate * (1 - gcOverhead) / gcOverhead;
+    if(free < FREE_MIN * live){
+        free = FREE_MIN * live;
+    }
+    else if(free > FREE_MAX * live){
+        free = FREE_MAX * live;
+    }
+    target = live + free;
+    heapTarget = heapTarget ? (heapTarget + target) / 2 : target;
+    if(heapLimit && heapTarget > heapLimit){
+        heapTarget = heapLimit;
+    }
+    shrinking = available > SHRINK_SLACK * heapTarget;
+}
+
+/*
+    Pools are carved out of address space reserved POOL_RESERVE pools at a
+    time, so that they're contiguous and the kernel can back them with huge
+    pages. Untouched pages of a reservation cost nothing.
+    A pool the sweep finds completely empty can be given back: its pages are
+    dropped with MADV_DONTNEED and it goes on emptyPools, keeping its address
+    space for the next time the heap grows. To keep from giving back memory
+    only to ask for it again, this is only done once the heap has grown to
+    SHRINK_SLACK times the size sizeHeap wants, and then only down to that
+    size. Either way, a pool comes back zeroed, so its header needs no
+    clearing.
+*/
+#define POOL_RESERVE 16
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+static unsigned char *reserveNext = NULL;
+static unsigned char *reserveEnd = NULL;
+static struct Pool *emptyPools = NULL;
+
 // Ask the OS to give us a new pool
 int allocNewPool(void ** pool)
 {
-    void *ret;
-    if ((errno = posix_memalign(pool, GGGGC_POOL_BYTES, GGGGC_POOL_BYTES))) {
-        return -1;
+    unsigned char *space, *aspace;
+    ggc_size_t bytes = (ggc_size_t)POOL_RESERVE * GGGGC_POOL_BYTES;
+
+    if(emptyPools){
+        *pool = emptyPools;
+        emptyPools = emptyPools->next;
+        return 0;
+    }
+
+    if(reserveNext == reserveEnd){
+        // map enough that we can align it, then trim the ends
+        space = (unsigned char *) mmap(NULL, bytes + GGGGC_POOL_BYTES, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0);
+        if(space == MAP_FAILED){
+            return -1;
+        }
+        aspace = (unsigned char *) POOL_OF(space + GGGGC_POOL_BYTES - 1);
+        if(aspace > space){
+            munmap(space, aspace - space);
+        }
+        munmap(aspace + bytes, space + GGGGC_POOL_BYTES - aspace);
+        #ifdef MADV_HUGEPAGE
+        madvise(aspace, bytes, MADV_HUGEPAGE);
+        #endif
+        reserveNext = aspace;
+        reserveEnd = aspace + bytes;
     }
+
+    *pool = reserveNext;
+    reserveNext += GGGGC_POOL_BYTES;
     #ifdef CHATTY
     ++poolCount;
     #endif
     return 0;
 }
 
+// Give an empty pool's memory back to the OS
+static void releasePool(struct Pool *pool){
+    madvise(pool, GGGGC_POOL_BYTES, MADV_DONTNEED);
+    pool->next = emptyPools;
+    emptyPools = pool;
+    available -= POOL_SIZE / sizeof(ggc_size_t);
+    setThresholds();
+}
+
+// Whether to give back an empty pool the sweep has found (see above)
+static inline int shouldReleasePool(){
+    return shrinking && available - POOL_SIZE / sizeof(ggc_size_t) >= heapTarget;
+}
+
 // Allocate a new pool and initialize it
 struct Pool *newPool(){
     struct Pool *ret;
@@ -261,22 +661,25 @@ struct Pool *newPool(){
 
     /* set it up */
     ret->next = NULL;
-    ret->freelist = NULL;
     ret->endptr = ret->memSpace;
     #ifdef GUARD
     assertPtrAligned(ret->endptr);
     #endif
 
-    // Update the load factor
     available += POOL_SIZE / sizeof(ggc_size_t);
-    loadFactor = allocated / (double)available;
+    setThresholds();
 
     return ret;
 }
 
 // Allocate a new pool, initialize it, and append it to the linked list
 int appendNewPool(){
-    struct Pool *p = newPool();
+    struct Pool *p;
+    // there's always room for one pool, however low the limit
+    if(heapLimit && available && available + POOL_SIZE / sizeof(ggc_size_t) > heapLimit){
+        return -1;
+    }
+    p = newPool();
     if(p == NULL){
         printf("newPool() failed.\n");
         return -1;
@@ -293,55 +696,254 @@ int appendNewPool(){
     return 0;
 }
 
-int ggggc_yield(){
+// Grow the heap to the size sizeHeap chose
+static void growHeap(){
+    while(available < heapTarget && appendNewPool() == 0);
+}
+
+// Sweep a pool, returning 0 if it was completely empty
+// Only marked objects are visited, found through the mark bitmap. The space
+// between one live object and the next is all dead objects and old free
+// blocks, so it becomes a single free block. The mark bits are left alone,
+// since they're what make the survivors old (see ggggc_collect0).
+static int sweepPool(struct Pool *pool){
+    ggc_size_t *freeStart = pool->memSpace;
+    ggc_size_t *pointer;
+    ggc_size_t markWord, lastMarkWord, bits, wordval;
+    lastMarkWord = MARK_INDEX(pool->endptr - 1) / GGGGC_BITS_PER_WORD;
+    for(markWord = MARK_INDEX(pool->memSpace) / GGGGC_BITS_PER_WORD; markWord <= lastMarkWord; ++markWord){
+        bits = pool->markBits[markWord];
+        if(!bits){
+            continue;
+        }
+        do{
+            pointer = (ggc_size_t *)pool + markWord * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits);
+            bits &= bits - 1;
+            #ifdef GUARD
+            if(testFree(pointer)){
+                printf("Object marked as free and pointed\n");
+                abort();
+            }
+            #endif
+            // free everything since the last live object
+            if(pointer > freeStart){
+                memset(freeStart, 0, (pointer - freeStart) * sizeof(ggc_size_t));
+                pushFree(freeStart, pointer - freeStart);
+            }
+            wordval = ((struct GGGGC_Header *)pointer)->descriptor__ptr->size;
+            // If this size is too small, we must have overallocated
+            if(wordval < MIN_BLOCK){
+                wordval = MIN_BLOCK;
+            }
+            #ifdef CHATTY
+            printf("Obj at %p is marked\n", pointer);
+            #endif
+            freeStart = pointer + wordval;
+        }while(bits);
+    }
+    // and the space after the last live object
+    if(freeStart < pool->endptr){
+        if(freeStart == pool->memSpace && pool != currentPool){
+            // nothing was pushed, so the caller can decide what to do with it
+            return 0;
+        }
+        memset(freeStart, 0, (pool->endptr - freeStart) * sizeof(ggc_size_t));
+        if(pool == currentPool){
+            // we're still bump allocating here, so just give it back
+            pool->endptr = freeStart;
+        }
+        else{
+            pushFree(freeStart, pool->endptr - freeStart);
+        }
+    }
+    return 1;
+}
+
+// Sweep the next unswept pool, if there is one. Returns 0 if there was none.
+static int sweepSome(){
+    struct Pool *pool = sweepNext;
+    if(pool == sweepEnd){
+        return 0;
+    }
+    sweepNext = pool->next;
+    if(sweepPool(pool)){
+        sweepPrev = pool;
+    }
+    else if(shouldReleasePool()){
+        // unlink it; it's before currentPool, so it isn't lastPool
+        if(sweepPrev){
+            sweepPrev->next = sweepNext;
+        }
+        else{
+            poolList = sweepNext;
+        }
+        releasePool(pool);
+    }
+    else{
+        memset(pool->memSpace, 0, (pool->endptr - pool->memSpace) * sizeof(ggc_size_t));
+        pushFree(pool->memSpace, pool->endptr - pool->memSpace);
+        sweepPrev = pool;
+    }
+    return 1;
+}
+
+// Sweep everything left over from the last collection, before marking again
+static void finishSweeping(){
+    while(sweepSome());
+}
+
+// Put the unused end of a pool on the free lists, so we can move on from it
+static void retirePool(struct Pool *pool){
+    ggc_size_t *end = (ggc_size_t *)((unsigned char *)(pool->memSpace) + POOL_SIZE);
+    if(end - pool->endptr >= MIN_BLOCK){
+        pushFree(pool->endptr, end - pool->endptr);
+        pool->endptr = end;
+    }
+}
+
+// Allocate a large object
+static void *mallocLarge(struct GGGGC_Descriptor **descriptor, ggc_size_t size){
+    ggc_size_t page = sysconf(_SC_PAGESIZE);
+    ggc_size_t bytes = (sizeof(struct LargeObject) + size * sizeof(ggc_size_t) + page - 1) & ~(page - 1);
+    unsigned char *space, *aspace;
+    struct LargeObject *lo;
+
+    // large objects don't fill the pools, so collect once as much has gone
+    // into them as the pools can hold
+    largeAllocated += size;
+    if(largeAllocated > available){
+        GGC_PUSH_1(*descriptor);
+        collect(0, GGGGC_COLLECT_LARGE);
+        GGC_POP();
+    }
+
+    // map enough that we can align it, then trim the ends
+    space = (unsigned char *) mmap(NULL, bytes + GGGGC_POOL_BYTES, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if(space == MAP_FAILED){
+        printf("Failed to map a large object.\n");
+        return NULL;
+    }
+    aspace = (unsigned char *) POOL_OF(space + GGGGC_POOL_BYTES - 1);
+    if(aspace > space){
+        munmap(space, aspace - space);
+    }
+    munmap(aspace + bytes, space + GGGGC_POOL_BYTES - aspace);
+
+    // fresh mappings are zeroed, so there's nothing more to clear
+    lo = (struct LargeObject *)aspace;
+    lo->bytes = bytes;
+    largeBytes += bytes;
+    lo->next = largeObjects;
+    largeObjects = lo;
+    if(ggggc_incrementalMarking){
+        tryMark(lo->memSpace);
+    }
+    return lo->memSpace;
+}
+
+// Unmap the large objects that weren't marked
+static void sweepLarge(){
+    struct LargeObject **lop = &largeObjects, *lo;
+    while((lo = *lop)){
+        if(testMarked(lo->memSpace)){
+            lop = &lo->next;
+        }
+        else{
+            *lop = lo->next;
+            largeBytes -= lo->bytes;
+            munmap(lo, lo->bytes);
+        }
+    }
+}
+
+static void markSlice();
+static void initIncrementalMark();
+
+static int yield(){
     // Pretend we are waiting for something
     // check heap usage
     // collect if load factor is too large
-    int err = 0;
-    if(loadFactor > LOAD_COLLECT){
-        ggggc_collect0(0);
-        if(loadFactor > LOAD_EXPAND){
-            err = 0;
-            // at least allocate 1 new pool
-            do{
-                #ifdef CHATTY
-                printf("*** 1 new pool appended ***\n");
-                #endif
-                err = appendNewPool();
-            }while(err == 0 && loadFactor > LOAD_IDEAL);
-        }
+    if(allocated > collectAt){
+        collect(0, GGGGC_COLLECT_YIELD);
     }
     return 0;
 }
 
+/*
+    Allocation sampling. sampleCountdown goes down by the size of every
+    allocation, and when it runs out, the allocation is sampled and it's
+    wound up again by a random amount averaging sampleInterval, so that
+    regular allocation patterns can't hide between samples. Each time it's
+    wound up stands for sampleInterval bytes, so a large allocation may stand
+    for several samples' worth. With sampling off, it starts so high it never
+    runs out.
+*/
+static void sampleAllocation(struct GGGGC_Descriptor **descriptor, ggc_size_t size){
+    ggc_size_t weight = 0;
+    while(sampleCountdown <= 0){
+        // xorshift, for an interval in [1, 2 * sampleInterval)
+        sampleSeed ^= sampleSeed << 13;
+        sampleSeed ^= sampleSeed >> 7;
+        sampleSeed ^= sampleSeed << 17;
+        sampleCountdown += 1 + sampleSeed % (2 * sampleInterval - 1);
+        weight += sampleInterval;
+    }
+    allocationHook(descriptor ? *descriptor : NULL, size * sizeof(ggc_size_t), weight);
+}
+
+/* sample about one allocation in every interval bytes */
+void ggggc_setAllocationSampler(ggc_size_t interval, ggggc_allocation_hook_t hook)
+{
+    if(interval && hook){
+        sampleInterval = interval;
+        allocationHook = hook;
+        sampleCountdown = 1 + (long)(sampleSeed % (2 * interval - 1));
+    }
+    else{
+        sampleCountdown = LONG_MAX;
+        allocationHook = NULL;
+    }
+}
+
 /* allocate an object without a descriptor */
-void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to protect, if applicable */
+static void *mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to protect, if applicable */
     ggc_size_t size /* size of object to allocate */
     ){
     #ifdef CHATTY
     printf("Raw malloc %lu bytes\n", size * sizeof(size));
     #endif
-    // size too large?
-    if(size > POOL_SIZE / sizeof(ggc_size_t)){
-        printf("Requested space cannot fit in a pool.\n");
-        return NULL;
-    }
     int err = 0;
     struct GGGGC_Header *mem = NULL;
-    int foundFreeSpace = 0;
     int GC_ed = 0;
     int expanded = 0;
     // Allocate a pool if there is none
     if(currentPool == NULL){
         if(poolList == NULL){
+            if(gcOverhead < 0){
+                initHeapPolicy();
+            }
             err = appendNewPool();
             if(err){
                 printf("Cannot initialize pool list.\n");
                 return NULL;
             }
+            lastCollectionEnd = nowNs();
         }
         currentPool = poolList;
     }
+    // large objects get their own space
+    if(size >= LARGE_OBJECT_WORDS){
+        mem = (struct GGGGC_Header *)mallocLarge(descriptor, size);
+        #ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
+        if(mem){
+            mem->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
+        }
+        #endif
+        if(mem && (sampleCountdown -= size * sizeof(ggc_size_t)) <= 0){
+            sampleAllocation(descriptor, size);
+        }
+        return (void *)mem;
+    }
     #ifdef GUARD
     assertPtrAligned(currentPool->endptr);
     #endif
@@ -349,82 +951,50 @@ void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to pro
     if(size * sizeof(ggc_size_t) < HEADER_SIZE){
         size = HEADER_SIZE / sizeof(ggc_size_t);    // must ensure HEADER_SIZE is multiple of sizeof(ggc_size_t)
     }
+    // do some incremental marking now and then
+    if(pauseTarget < 0){
+        initIncrementalMark();
+    }
+    if(pauseTarget){
+        sliceAllocated += size;
+        if(sliceAllocated >= MARK_SLICE_WORDS){
+            GGC_PUSH_1(*descriptor);
+            sliceAllocated = 0;
+            markSlice();
+            GGC_POP();
+        }
+    }
     CHECK:
     #ifdef GUARD
     assertPtrAligned(currentPool->endptr);
     #endif
-    // check if there is enough space in current pool
-    if((unsigned char *)(currentPool->memSpace) + POOL_SIZE >= (unsigned char *)(currentPool->endptr + size)){
-        // bump pointer
-        #ifdef CHATTY
-        printf("*** Bump pointer ***\n");
-        #endif
-        mem = (struct GGGGC_Header *)currentPool->endptr;
-        currentPool->endptr += size;    // size * sizeof(ggc_size_t) bytes
-        mem->descriptor__ptr = NULL;
-#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
-        /* set its canary */
-        mem->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
-#endif
-        // Clear memory
-        memset((void *)((unsigned char *)mem + sizeof(struct GGGGC_Header)), 0, size * sizeof(ggc_size_t) - sizeof(struct GGGGC_Header));
+    // the free lists cover all the space left behind in earlier pools, once
+    // they're swept
+    mem = (struct GGGGC_Header *)allocFree(size);
+    while(mem == NULL && sweepSome()){
+        mem = (struct GGGGC_Header *)allocFree(size);
     }
-    else{
-        // go through free list
-        // strategy: first
-        #ifdef CHATTY
-        printf("*** Search free list ***\n");
-        #endif
-        for(struct FreeObjHeader *prev = NULL, *p = currentPool->freelist; p;){
-            #ifdef GUARD
-            if(!testFree((ggc_size_t *)p)){
-                printf("Object not marked as free\n");
-                assertParsableHeap();
-                abort();
-            }
+    if(mem == NULL){
+        // move on to a fresh pool if this one is full
+        while((unsigned char *)(currentPool->memSpace) + POOL_SIZE < (unsigned char *)(currentPool->endptr + size) &&
+              currentPool->next){
+            retirePool(currentPool);
+            currentPool = currentPool->next;
+        }
+        // check if there is enough space in current pool
+        if((unsigned char *)(currentPool->memSpace) + POOL_SIZE >= (unsigned char *)(currentPool->endptr + size)){
+            // bump pointer
+            #ifdef CHATTY
+            printf("*** Bump pointer ***\n");
             #endif
-            if(p->size == size){
-                // perfect
-                mem = (struct GGGGC_Header *)p;
-                // remove p from free list
-                if(prev != NULL){
-                    #ifdef GUARD
-                    if(!testFree(p) || !testFree(prev)){
-                        printf("p and prev should both be marked.\n");
-                        abort();
-                    }
-                    #endif
-                    prev->next = p->next;
-                }
-                else{
-                    // First entry in the free list
-                    currentPool->freelist = (struct FreeObjHeader *)maskMarks((ggc_size_t)(p->next));
-                    #ifdef GUARD
-                    if(currentPool->freelist!= NULL && !testFree(currentPool->freelist)){
-                        printf("p->next should both be marked.\n");
-                        abort();
-                    }
-                    #endif
-                }
-                foundFreeSpace = 1;
-                break;
-            }
-            else if(p->size >= size + sizeof(struct FreeObjHeader) / sizeof(ggc_size_t)){
-                // split
-                mem = (ggc_size_t *)p + (p->size - size);
-                p->size -= size;
-                foundFreeSpace = 1;
-                break;
-            }
-            prev = p;
-            p = (struct FreeObjHeader *)maskMarks((ggc_size_t)(p->next));
+            mem = (struct GGGGC_Header *)currentPool->endptr;
+            currentPool->endptr += size;    // size * sizeof(ggc_size_t) bytes
         }
-        if(!foundFreeSpace){
-            // Go to the next pool if possible
-            if(currentPool->next){
-                currentPool = currentPool->next;
-                goto CHECK;
-            }
+        else if(ggggc_incrementalMarking && appendNewPool() == 0){
+            // rather than stop to finish marking, make room to keep going
+            goto CHECK;
+        }
+        else{
             // Full GC
             // Don't recycle the descriptor
             if(!GC_ed){
@@ -432,17 +1002,9 @@ void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to pro
                 #ifdef CHATTY
                 printf("*** GC during mallocRaw ***\n");
                 #endif
-                ggggc_collect0(0);
+                collect(0, GGGGC_COLLECT_ALLOCATION);
                 GGC_POP();
                 GC_ed = 1;
-                // Still too full?
-                if(loadFactor > LOAD_EXPAND){
-                    err = 0;
-                    do{
-                        err = appendNewPool();
-                    }while(err == 0 && loadFactor > LOAD_IDEAL);
-                    expanded = 1;
-                }
                 goto CHECK;
             }
             else{
@@ -450,57 +1012,118 @@ void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to pro
                     #ifdef CHATTY
                     printf("*** Allocate new pool ***\n");
                     #endif
-                    // allocate new pools
-                    err = 0;
                     // at least allocate 1 new pool
-                    do{
-                        #ifdef CHATTY
-                        printf("*** 1 new pool appended ***\n");
-                        #endif
-                        err = appendNewPool();
-                    }while(err == 0 && loadFactor > LOAD_IDEAL);
                     expanded = 1;
-                    goto CHECK;
+                    if(appendNewPool() == 0){
+                        growHeap();
+                        goto CHECK;
+                    }
                 }
-                else{
-                    // Should not hit here
-                    return NULL;
+                if(GC_ed == 1){
+                    // we're at the heap limit, so find every last free word
+                    GGC_PUSH_1(*descriptor);
+                    collect(1, GGGGC_COLLECT_LIMIT);
+                    GGC_POP();
+                    GC_ed = 2;
+                    goto CHECK;
                 }
+                fprintf(stderr, "GGGGC: Out of memory!\n");
+                abort();
             }
         }
-        else{
-            // must set this pointer AFTER maintaining linked list
-            mem->descriptor__ptr = NULL;
-            #ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
-            /* set its canary */
-            mem->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
-            #endif
-            memset((void *)mem + sizeof(struct GGGGC_Header), 0, size * sizeof(ggc_size_t) - sizeof(struct GGGGC_Header));
+    }
+
+    // objects allocated while marking can't be in the snapshot, so they're
+    // allocated already marked
+    if(ggggc_incrementalMarking){
+        tryMark((ggc_size_t *)mem);
+        markedWords += size;
+    }
+
+    // must set this pointer AFTER maintaining the free lists
+    mem->descriptor__ptr = NULL;
+    #ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
+    /* set its canary */
+    mem->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
+    #endif
+    #ifdef GUARD
+    for(ggc_size_t i = MIN_BLOCK; i < size; ++i){
+        if(((ggc_size_t *)mem)[i]){
+            printf("Free memory not zeroed\n");
+            abort();
         }
     }
+    #endif
+    // Free memory is already zeroed, but for any free block header left here
+    memset((void *)((unsigned char *)mem + sizeof(struct GGGGC_Header)), 0, HEADER_SIZE - sizeof(struct GGGGC_Header));
     #ifdef GUARD
     assertPtrAligned(mem);  // Unaligned pointers must not leave our allocator
     #endif
 
-    // Update load factor
     allocated += size;
-    loadFactor = allocated / (double)available;
+    if((sampleCountdown -= size * sizeof(ggc_size_t)) <= 0){
+        sampleAllocation(descriptor, size);
+    }
     return (void *)mem;
 }
 
-/* allocate an object */
-void *ggggc_malloc(struct GGGGC_Descriptor *descriptor)
-{
-    #ifdef CHATTY
-    //printf("malloc with descriptor at %p\n", descriptor);
-    //objDump((struct GGGGC_Header *)descriptor);
-    #endif
-    struct GGGGC_Header *ret = (struct GGGGC_Header *) ggggc_mallocRaw(&descriptor, descriptor->size);
-    #ifdef GUARD
-    assertPtrAligned(ret);
+/*
+    Permanent space, for objects that live as long as the program. Permanent
+    pools aren't in poolList, so they're never swept, and their objects are
+    marked as they're allocated. Since beginMarking only clears the mark bits
+    of poolList, they stay marked, and marking stops at them as it would at
+    any old object. Their pointers into the heap still have to be followed,
+    though. The write barrier dirties their cards just like an old object's,
+    and every collection, minor or major, scans the objects on dirty permanent
+    cards (see pushPermanentCards). A card is only cleaned once nothing on it
+    points out of permanent space, so the dirty cards are the remembered set.
+    Every new permanent object's card starts dirty, since its descriptor may
+    be in the heap. Permanent pools are bump allocated, newest first, and
+    don't count toward the heap's size.
+*/
+static struct Pool *permanentPools = NULL;
+static ggc_size_t permanentWords = 0;
+
+// Whether this points into permanent space
+static int isPermanent(void *ptr){
+    struct Pool *pool;
+    for(pool = permanentPools; pool; pool = pool->next){
+        if(pool == POOL_OF(ptr)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Allocate an object in permanent space, or in the heap if it's too big
+static void *mallocRawPermanent(struct GGGGC_Descriptor **descriptor, ggc_size_t size){
+    struct Pool *pool = permanentPools;
+    struct GGGGC_Header *mem;
+    if(size >= LARGE_OBJECT_WORDS){
+        return mallocRaw(descriptor, size);
+    }
+    if(size * sizeof(ggc_size_t) < HEADER_SIZE){
+        size = HEADER_SIZE / sizeof(ggc_size_t);
+    }
+    if(pool == NULL || (unsigned char *)(pool->memSpace) + POOL_SIZE < (unsigned char *)(pool->endptr + size)){
+        // fresh pools come zeroed
+        if(allocNewPool((void **)&pool)){
+            fprintf(stderr, "GGGGC: Out of memory!\n");
+            abort();
+        }
+        pool->next = permanentPools;
+        pool->endptr = pool->memSpace;
+        permanentPools = pool;
+    }
+    mem = (struct GGGGC_Header *)pool->endptr;
+    pool->endptr += size;
+    permanentWords += size;
+    tryMark((ggc_size_t *)mem);
+    pool->cards[GGGGC_CARD_OF(mem)] = 1;
+    #ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
+    mem->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
     #endif
-    ret->descriptor__ptr = descriptor;
-    return ret;
+    return (void *)mem;
 }
 
 // Copied from gembc
@@ -571,6 +1194,7 @@ void pointerStackDump(){
     struct GGGGC_JITPointerStackList jitPointerStackNode, *jpslCur;
     struct GGGGC_PointerStack *psCur;
     void **jpsCur;
+    struct GGGGC_JITStackWalk jitWalk;
     ggc_size_t i = 0;
     pointerStackNode.pointerStack = ggggc_pointerStack;
     pointerStackNode.next = ggggc_blockedThreadPointerStacks;
@@ -594,216 +1218,1269 @@ void pointerStackDump(){
         }
     }
     for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
+        for (jpsCur = ggggc_jitStackFirst(&jitWalk, jpslCur); jpsCur; jpsCur = ggggc_jitStackNext(&jitWalk)) {
             printf("Found JIT root pointer %p\n", *(void **)jpsCur);
         }
     }
 }
 #endif
 
-/* run a generation 0 collection */
-void ggggc_collect0(unsigned char gen)
-{
-    // I have no idea about the meaning of these variables
-    // I just copied them from gembc
-    struct GGGGC_PointerStackList pointerStackNode, *pslCur;
-    struct GGGGC_JITPointerStackList jitPointerStackNode, *jpslCur;
-    struct GGGGC_PointerStack *psCur;
+/*
+    Objects popped from the mark stack go through a small FIFO before they're
+    scanned. Each is prefetched (along with its mark bit) as it goes in, so by
+    the time it comes out, the cache miss has hopefully been served.
+*/
+#define PREFETCH_FIFO_SZ 8
+struct PrefetchFifo{
+    void *buf[PREFETCH_FIFO_SZ];
+    unsigned int head, count;
+};
+#define PREFETCH_FIFO_INIT(fifo) ((fifo).head = (fifo).count = 0)
+#define PREFETCH_FIFO_FULL(fifo) ((fifo).count == PREFETCH_FIFO_SZ)
+#define PREFETCH_FIFO_EMPTY(fifo) ((fifo).count == 0)
+#define PREFETCH_FIFO_ADD(fifo, ptr) do { \
+    void *pfPtr = (ptr); \
+    ggc_size_t pfIdx = MARK_INDEX(pfPtr); \
+    __builtin_prefetch(pfPtr); \
+    __builtin_prefetch(&POOL_OF(pfPtr)->markBits[pfIdx / GGGGC_BITS_PER_WORD]); \
+    (fifo).buf[((fifo).head + (fifo).count++) % PREFETCH_FIFO_SZ] = pfPtr; \
+} while(0)
+#define PREFETCH_FIFO_POP(fifo, into) do { \
+    into = (fifo).buf[(fifo).head]; \
+    (fifo).head = ((fifo).head + 1) % PREFETCH_FIFO_SZ; \
+    (fifo).count--; \
+} while(0)
+
+// Push onto a ToSearch list, for scanObject
+static void toSearchPush(void *arg, void *ptr){
+    struct ToSearch **toSearch = (struct ToSearch **)arg;
+    TOSEARCH_ADD((*toSearch), ptr);
+}
+
+// Pass each non-NULL pointer in an object (including its descriptor) to
+// push. Returns the object's size in words.
+static inline ggc_size_t scanFields(ggc_size_t *pointer, void (*push)(void *, void *), void *arg){
+    struct GGGGC_Descriptor *descriptor;
+    ggc_size_t word, words, bits;
+    void *child;
+
+    // The first word is the descriptor pointer in the GGGGC Header
+    descriptor = (struct GGGGC_Descriptor *)(*pointer);
+    #ifdef CHATTY
+    printf("Adding pointer %p\n", (void *)descriptor);
+    #endif
+    #ifdef GUARD
+    assertHeapPointer(descriptor);
+    #endif
+    // The descriptor pointer should always be alive. Descriptors are shared
+    // by many objects, so they're nearly always marked already, and checking
+    // here saves pushing and popping them for every object.
+    if(!testMarked((ggc_size_t *)descriptor)){
+        push(arg, descriptor);
+    }
+    #ifdef CHATTY
+    for(int i = 0; i < descriptor->size; ++i){
+        printf("Offset %08x: %lx\n", i * sizeof(ggc_size_t), *(pointer+i));
+    }
+    #endif
+    if(descriptor->pointers[0] & 1){
+        // Visit only the set bits of the pointer bitmap. Bit 0 is the
+        // descriptor pointer, handled above, and bits past the end of the
+        // object (which pointer array descriptors set) are ignored.
+        words = GGGGC_DESCRIPTOR_WORDS_REQ(descriptor->size);
+        for(word = 0; word < words; ++word){
+            bits = descriptor->pointers[word];
+            if(word == 0){
+                bits &= ~(ggc_size_t)1;
+            }
+            if(word == words - 1 && descriptor->size % GGGGC_BITS_PER_WORD){
+                bits &= ((ggc_size_t)1 << (descriptor->size % GGGGC_BITS_PER_WORD)) - 1;
+            }
+            while(bits){
+                child = (void *)pointer[word * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits)];
+                bits &= bits - 1;
+                if(!child){
+                    continue;
+                }
+                #ifdef GUARD
+                assertHeapPointer(child);
+                #endif
+                push(arg, child);
+                #ifdef CHATTY
+                printf("Adding pointer %p\n", child);
+                #endif
+            }
+        }
+    }
+    return MAX(descriptor->size, MIN_BLOCK);
+}
+
+// Mark an object and pass each non-NULL pointer in it (including its
+// descriptor) to push. Returns the object's size in words if we marked it, or
+// 0 if it was already marked.
+static inline ggc_size_t scanObject(ggc_size_t *pointer, void (*push)(void *, void *), void *arg){
+    ggc_size_t words;
+    #ifdef GUARD
+    assertHeapPointer(pointer);
+    #endif
+    // pointer --> obj header[ descriptor_ptr  --> descripor
+    //                         DEADBEEF
+    //                         value ... ]
+    #ifdef CHATTY
+    printf("Processing pointer %p\n", pointer);
+    printf("Obj descriptor at %p\n", ((struct GGGGC_Header *)pointer)->descriptor__ptr);
+    #endif
+#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
+    /* check for pre-corruption */
+    if (((struct GGGGC_Header *)pointer)->ggggc_memoryCorruptionCheck != GGGGC_MEMORY_CORRUPTION_VAL) {
+        fprintf(stderr, "GGGGC: Canary corrupted!\n");
+        fprintf(stderr, "Canary address: %p\n", &(((struct GGGGC_Header *)pointer)->ggggc_memoryCorruptionCheck));
+        fprintf(stderr, "Got: %lu\tExpected: %u\n", ((struct GGGGC_Header *)pointer)->ggggc_memoryCorruptionCheck, GGGGC_MEMORY_CORRUPTION_VAL);
+        abort();
+    }
+#endif
+    if(!tryMark(pointer)){    // already marked
+        #ifdef CHATTY
+        printf("Object already marked.\n");
+        #endif
+        return 0;
+    }
+    words = scanFields(pointer, push, arg);
+    // large objects aren't in the pools, so they don't count toward the load
+    return words < LARGE_OBJECT_WORDS ? words : 0;
+}
+
+// Pass the address of every root holding a non-NULL pointer to visit
+static void visitRoots(void (*visit)(void *, void **), void *arg){
+    struct GGGGC_PointerStackList pointerStackNode, *pslCur;
+    struct GGGGC_JITPointerStackList jitPointerStackNode, *jpslCur;
+    struct GGGGC_PointerStack *psCur;
     void **jpsCur;
-    struct ToSearch *currentBlock;
-    ggc_size_t wordval;
-    ggc_size_t * pointer;
-    struct FreeObjHeader *freeListPointer, *secondLastFreeListPointer;
+    struct GGGGC_JITStackWalk jitWalk;
+    ggc_size_t i;
+    void **root;
 
-    /* initialize our roots */
+    /* initialize our roots. The lists live in this frame, so they're walked
+     * from here rather than published in ggggc_rootPointerStackList */
     pointerStackNode.pointerStack = ggggc_pointerStack;
     pointerStackNode.next = ggggc_blockedThreadPointerStacks;
-    ggggc_rootPointerStackList = &pointerStackNode;
     jitPointerStackNode.cur = ggc_jitPointerStack;
     jitPointerStackNode.top = ggc_jitPointerStackTop;
     jitPointerStackNode.next = ggggc_blockedThreadJITPointerStacks;
-    ggggc_rootJITPointerStackList = &jitPointerStackNode;
-
-    #ifdef GUARD
-    assertParsableHeap();
-    #endif
-    TOSEARCH_INIT(currentBlock);
 
-    /* add our roots to the to-search list */
-    for (pslCur = ggggc_rootPointerStackList; pslCur; pslCur = pslCur->next) {
+    for (pslCur = &pointerStackNode; pslCur; pslCur = pslCur->next) {
         for (psCur = pslCur->pointerStack; psCur; psCur = psCur->next) {
             #ifdef CHATTY
             printf("%lu pointers in this stack\n", psCur->size);
             #endif
-            for (wordval = 0; wordval < psCur->size; wordval++) {
+            for (i = 0; i < psCur->size; i++) {
+                root = (void **)psCur->pointers[i];
                 #ifdef CHATTY
-                printf("Adding root pointer %p\n", *(void **)psCur->pointers[wordval]);
-                printf("Current block: %p\n", currentBlock);
+                printf("Adding root pointer %p\n", *root);
                 #endif
                 #ifdef GUARD
-                assertHeapPointer(*(void **)psCur->pointers[wordval]);
+                assertHeapPointer(*root);
                 #endif
-                TOSEARCH_ADD(currentBlock, *(void **)psCur->pointers[wordval]);
+                if(*root){
+                    visit(arg, root);
+                    ++rootsScanned;
+                }
             }
         }
     }
-    for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
+    for (jpslCur = &jitPointerStackNode; jpslCur; jpslCur = jpslCur->next) {
+        for (jpsCur = ggggc_jitStackFirst(&jitWalk, jpslCur); jpsCur; jpsCur = ggggc_jitStackNext(&jitWalk)) {
             #ifdef CHATTY
-            printf("Adding JIT root pointer %p\n", *(void **)jpsCur);
+            printf("Adding JIT root pointer %p\n", *jpsCur);
             #endif
             #ifdef GUARD
-            assertHeapPointer(*(void **)jpsCur);
+            assertHeapPointer(*jpsCur);
             #endif
-            TOSEARCH_ADD(currentBlock, *(void **)jpsCur);
+            if(*jpsCur){
+                visit(arg, jpsCur);
+                ++rootsScanned;
+            }
         }
     }
+}
 
-    // Mark
-    #ifdef CHATTY
-    printf("GC / Mark phase\n");
-    #endif
-    while(!TOSEARCH_EMPTY(currentBlock)){
-        TOSEARCH_POP(currentBlock, ggc_size_t *, pointer);
-        #ifdef GUARD
-        assertHeapPointer(pointer);
-        #endif
-        // pointer --> obj header[ descriptor_ptr  --> descripor
-        //                         DEADBEEF
-        //                         value ... ]
-        #ifdef CHATTY
-        printf("Processing pointer %p\n", pointer);
-        #endif
-        if(pointer == NULL){
+// A push function and its argument, for pushRoot
+struct RootPush{
+    void (*push)(void *, void *);
+    void *arg;
+};
+
+// Push what a root points to, for visitRoots
+static void pushRoot(void *arg, void **root){
+    struct RootPush *rootPush = (struct RootPush *)arg;
+    rootPush->push(rootPush->arg, *root);
+}
+
+// Pass every non-NULL root to push
+static void pushRoots(void (*push)(void *, void *), void *arg){
+    struct RootPush rootPush;
+    rootPush.push = push;
+    rootPush.arg = arg;
+    visitRoots(pushRoot, &rootPush);
+}
+
+// Pass every pointer in the old objects on dirty cards to push. Since every
+// object surviving a collection is old, only old objects written to since
+// then can point to young ones, and the write barrier has dirtied their cards.
+#define CARD_MARK_WORDS (GGGGC_CARD_BYTES / sizeof(ggc_size_t) / GGGGC_BITS_PER_WORD)
+static void pushCards(void (*push)(void *, void *), void *arg){
+    struct Pool *pool;
+    struct LargeObject *lo;
+    ggc_size_t card, markWord, bits;
+
+    for(pool = poolList; pool; pool = pool->next){
+        for(card = 0; card < GGGGC_CARDS_PER_POOL; ++card){
+            if(!pool->cards[card]){
+                continue;
+            }
+            for(markWord = card * CARD_MARK_WORDS; markWord < (card + 1) * CARD_MARK_WORDS; ++markWord){
+                bits = pool->markBits[markWord];
+                while(bits){
+                    scanFields((ggc_size_t *)pool + markWord * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits), push, arg);
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+    for(lo = largeObjects; lo; lo = lo->next){
+        if(lo->cards[GGGGC_CARD_OF(lo->memSpace)] && testMarked(lo->memSpace)){
+            scanFields(lo->memSpace, push, arg);
+        }
+    }
+}
+
+// Clean every card, once nothing young is left
+static void clearCards(){
+    struct Pool *pool;
+    struct LargeObject *lo;
+    for(pool = poolList; pool; pool = pool->next){
+        memset(pool->cards, 0, sizeof(pool->cards));
+    }
+    for(lo = largeObjects; lo; lo = lo->next){
+        lo->cards[GGGGC_CARD_OF(lo->memSpace)] = 0;
+    }
+}
+
+// Passes the pointers in permanent objects on to the marker
+struct PermanentScan{
+    void (*push)(void *, void *);
+    void *arg;
+    unsigned char *card;
+};
+static void pushPermanentChild(void *arg, void *ptr){
+    struct PermanentScan *scan = (struct PermanentScan *)arg;
+    if(isPermanent(ptr)){
+        return;
+    }
+    // this card still points into the heap
+    *scan->card = 1;
+    if(!testMarked((ggc_size_t *)ptr)){
+        scan->push(scan->arg, ptr);
+    }
+}
+
+// Pass every pointer into the heap from the permanent objects on dirty cards
+// to push, and clean the cards that have none
+static void pushPermanentCards(void (*push)(void *, void *), void *arg){
+    struct PermanentScan scan;
+    struct Pool *pool;
+    ggc_size_t card, markWord, bits;
+
+    scan.push = push;
+    scan.arg = arg;
+    for(pool = permanentPools; pool; pool = pool->next){
+        for(card = 0; card < GGGGC_CARDS_PER_POOL; ++card){
+            if(!pool->cards[card]){
+                continue;
+            }
+            scan.card = &pool->cards[card];
+            *scan.card = 0;
+            for(markWord = card * CARD_MARK_WORDS; markWord < (card + 1) * CARD_MARK_WORDS; ++markWord){
+                bits = pool->markBits[markWord];
+                while(bits){
+                    ggggc_walkObject((ggc_size_t *)pool + markWord * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits), pushPermanentChild, &scan);
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+}
+
+#if GGGGC_THREADS_POSIX
+/*
+    Parallel marking. With GGGGC_MARK_THREADS=n in the environment, the
+    collecting thread and n-1 helper threads mark together. Each has a
+    Chase-Lev work-stealing deque: the owner pushes and takes at the bottom,
+    and workers that run out of work steal from the top of the others. The
+    roots are gathered first and split evenly between the workers.
+*/
+#define PARALLEL_MARK 1
+
+// Deques grow by copying into a larger array. Thieves may still be reading
+// the old one, so it's only freed once marking is over.
+struct MarkDequeArray{
+    struct MarkDequeArray *old;
+    long size;  // always a power of 2
+    void *buf[];
+};
+
+struct MarkWorker{
+    long top, bottom;
+    struct MarkDequeArray *array;
+    ggc_size_t allocated;   // words this worker marked live
+    unsigned int id;
+    pthread_t thread;
+    char pad[64];   // keep workers off each other's cache lines
+};
+
+#define MARK_DEQUE_INITIAL 4096
+#define MARK_STEAL_ABORT ((void *) 1)
+
+static unsigned int markThreads = 0;    // 0 until we've read the environment
+static struct MarkWorker *markWorkers = NULL;
+static ggc_barrier_t markStartBarrier, markEndBarrier;
+static void **markRoots = NULL;
+static ggc_size_t markRootCount = 0, markRootSize = 0;
+static unsigned int markIdle;
+
+static struct MarkDequeArray *newMarkDequeArray(long size){
+    struct MarkDequeArray *ret = (struct MarkDequeArray *)malloc(sizeof(struct MarkDequeArray) + size * sizeof(void *));
+    if(ret == NULL){
+        perror("malloc");
+        abort();
+    }
+    ret->old = NULL;
+    ret->size = size;
+    return ret;
+}
+
+// Owner only: push onto the bottom
+static void markDequePush(struct MarkWorker *w, void *ptr){
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    struct MarkDequeArray *a = w->array;
+    long i;
+    if(b - t > a->size - 1){
+        // full, so grow
+        struct MarkDequeArray *na = newMarkDequeArray(a->size * 2);
+        for(i = t; i < b; ++i){
+            na->buf[i & (na->size - 1)] = a->buf[i & (a->size - 1)];
+        }
+        na->old = a;
+        __atomic_store_n(&w->array, na, __ATOMIC_RELEASE);
+        a = na;
+    }
+    __atomic_store_n(&a->buf[b & (a->size - 1)], ptr, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+// Owner only: take from the bottom, or NULL if empty
+static void *markDequeTake(struct MarkWorker *w){
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    struct MarkDequeArray *a = w->array;
+    long t;
+    void *ret = NULL;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    if(t <= b){
+        ret = __atomic_load_n(&a->buf[b & (a->size - 1)], __ATOMIC_RELAXED);
+        if(t == b){
+            // the last one, so we have to race the thieves for it
+            if(!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+                ret = NULL;
+            }
+            __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else{
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+// Anyone: steal from the top. Returns NULL if empty, or MARK_STEAL_ABORT if
+// we lost a race and should try again.
+static void *markDequeSteal(struct MarkWorker *w){
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    long b;
+    struct MarkDequeArray *a;
+    void *ret;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if(t >= b){
+        return NULL;
+    }
+    a = __atomic_load_n(&w->array, __ATOMIC_ACQUIRE);
+    ret = __atomic_load_n(&a->buf[t & (a->size - 1)], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+        return MARK_STEAL_ABORT;
+    }
+    return ret;
+}
+
+// Push onto a worker's own deque, for scanObject
+static void markDequePushArg(void *arg, void *ptr){
+    markDequePush((struct MarkWorker *)arg, ptr);
+}
+
+// Collect a root, for pushRoots
+static void markRootPush(void *arg, void *ptr){
+    if(markRootCount >= markRootSize){
+        markRootSize = markRootSize ? markRootSize * 2 : 1024;
+        markRoots = (void **)realloc(markRoots, markRootSize * sizeof(void *));
+        if(markRoots == NULL){
+            perror("realloc");
+            abort();
+        }
+    }
+    markRoots[markRootCount++] = ptr;
+}
+
+// Is there anything left to steal?
+static int markWorkAvailable(){
+    unsigned int i;
+    for(i = 0; i < markThreads; ++i){
+        if(__atomic_load_n(&markWorkers[i].top, __ATOMIC_ACQUIRE) <
+           __atomic_load_n(&markWorkers[i].bottom, __ATOMIC_ACQUIRE)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// One worker's share of the marking
+static void markWork(struct MarkWorker *w){
+    ggc_size_t i, end;
+    unsigned int v;
+    void *ptr;
+    struct PrefetchFifo fifo;
+
+    // our share of the roots
+    end = markRootCount * (w->id + 1) / markThreads;
+    for(i = markRootCount * w->id / markThreads; i < end; ++i){
+        markDequePush(w, markRoots[i]);
+    }
+
+    while(1){
+        // our own work first
+        PREFETCH_FIFO_INIT(fifo);
+        while(1){
+            while(!PREFETCH_FIFO_FULL(fifo) && (ptr = markDequeTake(w))){
+                PREFETCH_FIFO_ADD(fifo, ptr);
+            }
+            if(PREFETCH_FIFO_EMPTY(fifo)){
+                break;
+            }
+            PREFETCH_FIFO_POP(fifo, ptr);
+            w->allocated += scanObject((ggc_size_t *)ptr, markDequePushArg, w);
+        }
+
+        // then anyone else's
+        for(v = 1; v < markThreads; ++v){
+            do{
+                ptr = markDequeSteal(&markWorkers[(w->id + v) % markThreads]);
+            }while(ptr == MARK_STEAL_ABORT);
+            if(ptr){
+                break;
+            }
+        }
+        if(ptr){
+            w->allocated += scanObject((ggc_size_t *)ptr, markDequePushArg, w);
             continue;
         }
-        #ifdef CHATTY
-        printf("Obj descriptor at %p\n", ((struct GGGGC_Header *)pointer)->descriptor__ptr);
-        #endif
-#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
-        /* check for pre-corruption */
-        if (((struct GGGGC_Header *)pointer)->ggggc_memoryCorruptionCheck != GGGGC_MEMORY_CORRUPTION_VAL) {
-            fprintf(stderr, "GGGGC: Canary corrupted!\n");
-            fprintf(stderr, "Canary address: %p\n", &(((struct GGGGC_Header *)pointer)->ggggc_memoryCorruptionCheck));
-            fprintf(stderr, "Got: %lu\tExpected: %u\n", ((struct GGGGC_Header *)pointer)->ggggc_memoryCorruptionCheck, GGGGC_MEMORY_CORRUPTION_VAL);
+
+        // nothing to do, so wait until there's work or everyone's out of it.
+        // A worker only goes idle with an empty deque, so once all of them
+        // are idle, no more work can appear.
+        __atomic_add_fetch(&markIdle, 1, __ATOMIC_SEQ_CST);
+        while(1){
+            if(__atomic_load_n(&markIdle, __ATOMIC_SEQ_CST) == markThreads){
+                return;
+            }
+            if(markWorkAvailable()){
+                __atomic_sub_fetch(&markIdle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static void *markWorkerMain(void *arg){
+    struct MarkWorker *w = (struct MarkWorker *)arg;
+    while(1){
+        ggc_barrier_wait_raw(&markStartBarrier);
+        markWork(w);
+        ggc_barrier_wait_raw(&markEndBarrier);
+    }
+    return NULL;
+}
+
+// Read GGGGC_MARK_THREADS and start the helper threads
+static void initParallelMark(){
+    const char *env = getenv("GGGGC_MARK_THREADS");
+    unsigned int i;
+
+    markThreads = 1;
+    if(env && atoi(env) > 1){
+        markThreads = atoi(env);
+    }
+    if(markThreads == 1){
+        return;
+    }
+
+    markWorkers = (struct MarkWorker *)calloc(markThreads, sizeof(struct MarkWorker));
+    if(markWorkers == NULL){
+        perror("calloc");
+        abort();
+    }
+    ggc_barrier_init(&markStartBarrier, markThreads);
+    ggc_barrier_init(&markEndBarrier, markThreads);
+    for(i = 0; i < markThreads; ++i){
+        markWorkers[i].id = i;
+        markWorkers[i].array = newMarkDequeArray(MARK_DEQUE_INITIAL);
+        if(i > 0 && (errno = pthread_create(&markWorkers[i].thread, NULL, markWorkerMain, &markWorkers[i]))){
+            perror("pthread_create");
             abort();
         }
+    }
+}
+
+// Mark everything reachable from markRoots, in parallel
+static void markParallel(){
+    struct MarkDequeArray *old;
+    unsigned int i;
+
+    for(i = 0; i < markThreads; ++i){
+        markWorkers[i].top = markWorkers[i].bottom = 0;
+        markWorkers[i].allocated = 0;
+    }
+    markIdle = 0;
+
+    // we're worker 0
+    ggc_barrier_wait_raw(&markStartBarrier);
+    markWork(&markWorkers[0]);
+    ggc_barrier_wait_raw(&markEndBarrier);
+
+    for(i = 0; i < markThreads; ++i){
+        markedWords += markWorkers[i].allocated;
+        while((old = markWorkers[i].array->old)){
+            markWorkers[i].array->old = old->old;
+            free(old);
+        }
+    }
+}
 #endif
-        if(testPointed(pointer)){    // already marked
-            #ifdef CHATTY
-            printf("Object already marked.\n");
-            #endif
-            continue;
+
+/*
+    Incremental marking. With GGGGC_PAUSE_US=n in the environment, a
+    collection is spread over slices of about n microseconds of marking, run
+    by the allocator every MARK_SLICE_WORDS words, instead of stopping the
+    world for all of it. The roots are snapshotted when marking starts, and
+    the write barrier (GGGGC_WP) shades every pointer the mutator overwrites
+    while marking, so everything in that snapshot gets marked. Objects
+    allocated while marking are allocated already marked. If the heap fills
+    before marking is done, it's grown rather than stopping to finish.
+*/
+// Read GGGGC_PAUSE_US
+static void initIncrementalMark(){
+    const char *env = getenv("GGGGC_PAUSE_US");
+    pauseTarget = 0;
+    if(env && atoll(env) > 0){
+        pauseTarget = atoll(env) * 1000;
+    }
+}
+
+// The serial marker's stack
+static struct ToSearch *markStack;
+
+// Get ready to mark, with the serial marker's stack empty. For a major
+// collection, everything is young again.
+static void beginMarking(int major){
+    struct Pool *pool;
+    struct LargeObject *lo;
+    finishSweeping();
+    #ifdef GUARD
+    assertParsableHeap();
+    #endif
+    if(major){
+        for(pool = poolList; pool; pool = pool->next){
+            memset(pool->markBits, 0, sizeof(pool->markBits));
+        }
+        for(lo = largeObjects; lo; lo = lo->next){
+            memset(lo->markBits, 0, sizeof(lo->markBits));
         }
+        oldWords = 0;
+    }
+    markedWords = 0;
+    TOSEARCH_INIT(markStack);
+}
 
-        // The first word is the descriptor pointer in the GGGGC Header
-        struct GGGGC_Descriptor *descriptor = (struct GGGGC_Descriptor *)(*pointer);
-        #ifdef CHATTY
-        printf("Adding pointer %p\n", (void *)(*pointer));
-        #endif
-        #ifdef GUARD
-        assertHeapPointer((void *)*pointer);
-        #endif
-        TOSEARCH_ADD(currentBlock, (void *)*pointer);  // The descriptor pointer should always be alive
-        markPointed(pointer);
-        #ifdef CHATTY
-        for(int i = 0; i < descriptor->size; ++i){
-            printf("Offset %08x: %lx\n", i * sizeof(ggc_size_t), *(pointer+i));
+// Scan objects from the serial marker's stack until it's empty, or until the
+// deadline (in nanoseconds) passes if there is one. Returns 1 if the stack was
+// emptied.
+#define MARK_CLOCK_INTERVAL 256
+static int markFromStack(unsigned long long deadline){
+    struct PrefetchFifo fifo;
+    ggc_size_t *pointer;
+    unsigned int scanned = 0;
+    int more = 1;
+
+    PREFETCH_FIFO_INIT(fifo);
+    while(1){
+        while(more && !PREFETCH_FIFO_FULL(fifo) && !TOSEARCH_EMPTY(markStack)){
+            TOSEARCH_POP(markStack, ggc_size_t *, pointer);
+            PREFETCH_FIFO_ADD(fifo, pointer);
         }
-        #endif
-        if(descriptor->pointers[0] & 1 != 0){
-            // TODO: optimize
-            for(wordval = 1; wordval < descriptor->size; ++wordval){
-                int word = wordval / GGGGC_BITS_PER_WORD;
-                unsigned int pos = wordval % GGGGC_BITS_PER_WORD;
-                #ifdef CHATTY
-                printf("bitmap %lu\tpos %d\n", descriptor->pointers[word], pos);
-                #endif
-                if((descriptor->pointers[word] & (1 << pos)) != 0){
-                    #ifdef GUARD
-                    assertHeapPointer((void *)*(pointer + wordval));
-                    #endif
-                    TOSEARCH_ADD(currentBlock, (void *)*(pointer + wordval));
-                    #ifdef CHATTY
-                    printf("Adding pointer %p\n", (void *)(*(pointer + wordval)));
-                    #endif
-                }
+        if(PREFETCH_FIFO_EMPTY(fifo)){
+            break;
+        }
+        PREFETCH_FIFO_POP(fifo, pointer);
+        markedWords += scanObject(pointer, toSearchPush, &markStack);
+        // reading the clock isn't free, so only do it now and then. Once
+        // we're out of time, just finish what's in the FIFO.
+        if(deadline && ++scanned % MARK_CLOCK_INTERVAL == 0 && nowNs() >= deadline){
+            more = 0;
+        }
+    }
+    return TOSEARCH_EMPTY(markStack);
+}
+
+// Shade a pointer the mutator is about to overwrite
+void ggggc_markBarrier(void *old){
+    if(!testMarked((ggc_size_t *)old)){
+        TOSEARCH_ADD(markStack, old);
+    }
+}
+
+// Run one slice of incremental marking, starting a collection if the heap is
+// full enough and finishing it if there's nothing left to mark
+static void markSlice(){
+    unsigned long long start = nowNs();
+    unsigned long long deadline = start + pauseTarget;
+    int done;
+    if(!ggggc_incrementalMarking){
+        if(allocated <= markAt){
+            return;
+        }
+        // the last collection must be swept before we mark again, and that
+        // can take a few slices too
+        while(sweepSome()){
+            if(nowNs() >= deadline){
+                sliceNs += nowNs() - start;
+                return;
             }
         }
+        beginMarking(1);
+        pushRoots(toSearchPush, &markStack);
+        pushPermanentCards(toSearchPush, &markStack);
+        ggggc_incrementalMarking = 1;
     }
+    done = markFromStack(deadline);
+    // the heap sizing counts this as time spent collecting
+    sliceNs += nowNs() - start;
+    if(done){
+        collect(0, GGGGC_COLLECT_INCREMENTAL);
+    }
+}
 
-    // Sweep
-    // wordval used to keep the next step length
-    allocated = 0;
-    for(currentPool = poolList; currentPool; currentPool = currentPool->next){
-        freeListPointer = currentPool->freelist = NULL;
-        secondLastFreeListPointer = NULL;
-        for(pointer = currentPool->memSpace; pointer < currentPool->endptr;){
-            if(testPointed(pointer)){
-                #ifdef GUARD
-                if(testFree(pointer)){
-                    printf("Object marked as free and pointed\n");
-                    abort();
+/*
+    Compaction. Pools are never swept smaller, so a heap that has churned
+    through objects of many sizes can end up with its free space all in
+    fragments, and allocation stuck on the free lists for good. When the
+    fragments (free blocks smaller than FRAGMENT_WORDS) are more than
+    fragmentation of the heap as a collection starts, it's a major one, and
+    the live objects are slid down to the start of the pool list, in order,
+    leaving everything after them free to bump allocate from again.
+    It's done as in the Compressor, so that no object needs a word for its
+    forwarding address: the mark bits give each object's start, and from
+    them a bitmap of every live word is made, along with the new address of
+    the first live word of each block (the words covered by one word of the
+    bitmap). An object's new address is then its block's plus the live
+    words before it in the block. Objects can't straddle pools, so when one
+    doesn't fit at the end of a pool it skips to the next, and if that
+    happens in the middle of a block, the skip is noted too.
+    With the new addresses known, and before anything moves, every pointer
+    into the pools is updated: the roots, the pools' own objects, large
+    objects and permanent objects on dirty cards. Descriptors are only read
+    for their sizes and layouts, which updating doesn't change, and each
+    object's descriptor pointer is updated last, so nothing is read through
+    a new address before something is there. Then the pools are slid down in
+    order. Every live word moves to an address no later than its own in pool
+    order, so nothing is overwritten before it's moved.
+*/
+// A pool being compacted. It has at most a pool's worth of live objects, so
+// they skip at most two pool ends, since no object is near half a pool.
+#define COMPACT_SKIPS 2
+struct Compaction{
+    struct Pool *pool;
+    ggc_size_t *end;   // where its live objects will end
+    ggc_size_t live[MARK_WORDS];
+    ggc_size_t *offsets[MARK_WORDS];
+    unsigned int skips;
+    struct{
+        ggc_size_t word;
+        ggc_size_t *at;
+        ptrdiff_t gap;
+    }skip[COMPACT_SKIPS];
+};
+// The pools being compacted, in order, and hashed by address
+static struct Compaction **compactions = NULL;
+static struct Compaction **compactionTable = NULL;
+static ggc_size_t compactionTableSize = 0;
+
+// Whether enough of the heap has gone to fragments to be worth compacting
+static inline int shouldCompact(){
+    return fragmentWords > fragmentation * available;
+}
+
+// The compaction of the pool this points into, or NULL if it isn't moving
+static inline struct Compaction *compactionOf(void *ptr){
+    struct Pool *pool = POOL_OF(ptr);
+    ggc_size_t i = ((ggc_size_t)pool >> GGGGC_POOL_SIZE) & (compactionTableSize - 1);
+    while(compactionTable[i]){
+        if(compactionTable[i]->pool == pool){
+            return compactionTable[i];
+        }
+        i = (i + 1) & (compactionTableSize - 1);
+    }
+    return NULL;
+}
+
+// Where a live word will be once the pools are compacted
+static void *forward(void *ptr){
+    struct Compaction *c = compactionOf(ptr);
+    ggc_size_t idx, word, *ret;
+    unsigned int i;
+    if(!c){
+        return ptr;
+    }
+    idx = MARK_INDEX(ptr);
+    word = idx / GGGGC_BITS_PER_WORD;
+    ret = c->offsets[word] + __builtin_popcountl(c->live[word] &
+        (((ggc_size_t)1 << (idx % GGGGC_BITS_PER_WORD)) - 1));
+    for(i = 0; i < c->skips; ++i){
+        if(c->skip[i].word == word && (ggc_size_t *)ptr >= c->skip[i].at){
+            ret += c->skip[i].gap;
+        }
+    }
+    return ret;
+}
+
+// Choose where every live object in the pools up to currentPool goes.
+// Returns the index of the last pool anything goes in.
+static ggc_size_t planCompaction(ggc_size_t count){
+    struct Compaction *c, *dest = compactions[0];
+    ggc_size_t *fill = dest->pool->memSpace, *end, *pointer;
+    ggc_size_t i, destIndex = 0, markWord, lastMarkWord, bits, words, first, last, block;
+    for(i = 0; i < count; ++i){
+        c = compactions[i];
+        block = 0;
+        lastMarkWord = MARK_INDEX(c->pool->endptr - 1) / GGGGC_BITS_PER_WORD;
+        for(markWord = MARK_INDEX(c->pool->memSpace) / GGGGC_BITS_PER_WORD; markWord <= lastMarkWord; ++markWord){
+            bits = c->pool->markBits[markWord];
+            while(bits){
+                pointer = (ggc_size_t *)c->pool + markWord * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits);
+                bits &= bits - 1;
+                words = MAX(((struct GGGGC_Header *)pointer)->descriptor__ptr->size, MIN_BLOCK);
+                first = MARK_INDEX(pointer);
+                last = MARK_INDEX(pointer + words - 1);
+
+                // move on to the next pool if it doesn't fit here
+                end = (ggc_size_t *)((unsigned char *)(dest->pool->memSpace) + POOL_SIZE);
+                if(fill + words > end){
+                    dest->end = fill;
+                    dest = compactions[++destIndex];
+                    if(first / GGGGC_BITS_PER_WORD < block){
+                        // its block's address is already chosen
+                        if(c->skips == COMPACT_SKIPS){
+                            fprintf(stderr, "GGGGC: Too many skips compacting a pool!\n");
+                            abort();
+                        }
+                        c->skip[c->skips].word = first / GGGGC_BITS_PER_WORD;
+                        c->skip[c->skips].at = pointer;
+                        c->skip[c->skips].gap = dest->pool->memSpace - fill;
+                        ++c->skips;
+                    }
+                    fill = dest->pool->memSpace;
                 }
-                #endif
-                // marked
-                unmarkPointed(pointer); // unmark
-                wordval = ((struct GGGGC_Header *)pointer)->descriptor__ptr->size;  // record this now
-                // If this size is too small, we must have overallocated
-                if(wordval < HEADER_SIZE / sizeof(ggc_size_t)){
-                    wordval = HEADER_SIZE / sizeof(ggc_size_t);
+
+                // the blocks it starts
+                for(block = MAX(block, first / GGGGC_BITS_PER_WORD); block <= last / GGGGC_BITS_PER_WORD; ++block){
+                    c->offsets[block] = fill + (block * GGGGC_BITS_PER_WORD > first ?
+                        block * GGGGC_BITS_PER_WORD - first : 0);
                 }
-                allocated += wordval;
-                #ifdef CHATTY
-                printf("Obj at %p is marked\n", pointer);
-                #endif
+
+                // and its words
+                for(; first <= last; ++first){
+                    c->live[first / GGGGC_BITS_PER_WORD] |= (ggc_size_t)1 << (first % GGGGC_BITS_PER_WORD);
+                }
+                fill += words;
             }
-            else if(testFree(pointer)){
-                // Free object from last collection
-                wordval = ((struct FreeObjHeader *)pointer)->size;
+        }
+    }
+    dest->end = fill;
+    return destIndex;
+}
+
+// Point every pointer in an object (its descriptor last) where it's going
+static void forwardFields(ggc_size_t *pointer){
+    struct GGGGC_Descriptor *descriptor = (struct GGGGC_Descriptor *)(*pointer);
+    ggc_size_t word, words, bits, *slot;
+    if(descriptor->pointers[0] & 1){
+        words = GGGGC_DESCRIPTOR_WORDS_REQ(descriptor->size);
+        for(word = 0; word < words; ++word){
+            bits = descriptor->pointers[word];
+            if(word == 0){
+                bits &= ~(ggc_size_t)1;
             }
-            else{
-                // Unmarked, construct free object header
-                // Note:
-                // the descriptor of this object might have been collected
-                // need to ensure that the 'size' field of a collected descriptor is not overwritten
-                // The 'size' field is the 3rd word
-                #ifdef CHATTY
-                printf("Obj at %p is not marked\n", pointer);
-                #endif
-                wordval = ((struct GGGGC_Header *)pointer)->descriptor__ptr->size;  // record this now
-                // If this size is too small, we must have overallocated
-                if(wordval < HEADER_SIZE / sizeof(ggc_size_t)){
-                    wordval = HEADER_SIZE / sizeof(ggc_size_t);
+            if(word == words - 1 && descriptor->size % GGGGC_BITS_PER_WORD){
+                bits &= ((ggc_size_t)1 << (descriptor->size % GGGGC_BITS_PER_WORD)) - 1;
+            }
+            while(bits){
+                slot = &pointer[word * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits)];
+                bits &= bits - 1;
+                if(*slot){
+                    *slot = (ggc_size_t)forward((void *)*slot);
                 }
-                ((struct FreeObjHeader *)pointer)->size = ((struct GGGGC_Header *)pointer)->descriptor__ptr->size;  // overwrites the 2nd word
-                // descriptor__ptr is valid because this object has not been marked
-                ((struct FreeObjHeader *)pointer)->next = NULL; // overwrites the 1st word
-                markFree(pointer);
-                // Do not zero the memory!
-
-                // Now maintain the free list
-                if(freeListPointer){
-                    // TODO: merge consecutive blocks of empty memory
-                    freeListPointer->next = (struct FreeObjHeader *)pointer;
-                    markFree((ggc_size_t *)freeListPointer);
-                    secondLastFreeListPointer = (struct FreeObjHeader *)maskMarks((ggc_size_t)freeListPointer);
-                    freeListPointer = (struct FreeObjHeader *)maskMarks((ggc_size_t)(freeListPointer->next));
+            }
+        }
+    }
+    *pointer = (ggc_size_t)forward(descriptor);
+}
+
+// Point a root where it's going, for visitRoots
+static void forwardRoot(void *arg, void **root){
+    *root = forward(*root);
+}
+
+// Point every root where it's going. They were counted as they were marked.
+static void forwardRoots(){
+    ggc_size_t scanned = rootsScanned;
+    visitRoots(forwardRoot, NULL);
+    rootsScanned = scanned;
+}
+
+// Point everything outside the pools being compacted where it's going. Only
+// permanent objects on dirty cards point into the heap, and dead large
+// objects are already gone.
+static void forwardOutside(){
+    struct Pool *pool;
+    struct LargeObject *lo;
+    ggc_size_t card, markWord, bits;
+
+    forwardRoots();
+    for(lo = largeObjects; lo; lo = lo->next){
+        forwardFields(lo->memSpace);
+    }
+    for(pool = permanentPools; pool; pool = pool->next){
+        for(card = 0; card < GGGGC_CARDS_PER_POOL; ++card){
+            if(!pool->cards[card]){
+                continue;
+            }
+            for(markWord = card * CARD_MARK_WORDS; markWord < (card + 1) * CARD_MARK_WORDS; ++markWord){
+                bits = pool->markBits[markWord];
+                while(bits){
+                    forwardFields((ggc_size_t *)pool + markWord * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits));
+                    bits &= bits - 1;
                 }
-                else{
-                    // The first free object in this pool
-                    freeListPointer = currentPool->freelist = (struct FreeObjHeader *)pointer;  // pointer itself is never marked
+            }
+        }
+    }
+}
+
+// Slide a pool's objects, and their mark bits, to where they're going
+static void slidePool(struct Compaction *c){
+    struct Pool *pool = c->pool;
+    ggc_size_t *from, *to, *runEnd, *segEnd;
+    ggc_size_t markWord, firstMarkWord, lastMarkWord, bits, start, end, idx;
+    unsigned int i;
+
+    firstMarkWord = MARK_INDEX(pool->memSpace) / GGGGC_BITS_PER_WORD;
+    lastMarkWord = MARK_INDEX(pool->endptr - 1) / GGGGC_BITS_PER_WORD;
+    for(markWord = firstMarkWord; markWord <= lastMarkWord; ++markWord){
+        // the marks; every one going to this word is from this word or
+        // before, so it's been read already
+        bits = pool->markBits[markWord];
+        pool->markBits[markWord] = 0;
+        while(bits){
+            to = forward((ggc_size_t *)pool + markWord * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits));
+            bits &= bits - 1;
+            idx = MARK_INDEX(to);
+            POOL_OF(to)->markBits[idx / GGGGC_BITS_PER_WORD] |= (ggc_size_t)1 << (idx % GGGGC_BITS_PER_WORD);
+        }
+
+        // then each run of live words, split wherever it skips
+        bits = c->live[markWord];
+        while(bits){
+            start = __builtin_ctzl(bits);
+            end = ~(bits >> start) ? start + __builtin_ctzl(~(bits >> start)) : GGGGC_BITS_PER_WORD;
+            bits = end == GGGGC_BITS_PER_WORD ? 0 : bits & ~(((ggc_size_t)1 << end) - 1);
+            from = (ggc_size_t *)pool + markWord * GGGGC_BITS_PER_WORD + start;
+            runEnd = (ggc_size_t *)pool + markWord * GGGGC_BITS_PER_WORD + end;
+            while(from < runEnd){
+                segEnd = runEnd;
+                for(i = 0; i < c->skips; ++i){
+                    if(c->skip[i].word == markWord && c->skip[i].at > from && c->skip[i].at < segEnd){
+                        segEnd = c->skip[i].at;
+                    }
                 }
+                to = forward(from);
+                if(to != from){
+                    memmove(to, from, (segEnd - from) * sizeof(ggc_size_t));
+                }
+                from = segEnd;
             }
-            #ifdef CHATTY
-            printf("Increase pointer by %lu\n", wordval);
-            #endif
-            pointer += wordval;
         }
     }
-    loadFactor = allocated / (double)available; // Update load factor
-    currentPool = poolList; // reset to the first pool
-    #ifdef GUARD
-    assertParsableHeap();
-    #endif
 }
+
+// Compact the pools up to currentPool, which must have just been marked by a
+// major collection, and set them up to allocate from after the last live
+// object. Returns the number of words of live objects.
+static ggc_size_t compactHeap(){
+    struct Compaction *c;
+    struct Pool *pool, *prev, *next;
+    ggc_size_t count, i, j, last, bits, live = 0;
+
+    if(!currentPool){
+        return 0;
+    }
+    for(count = 0, pool = poolList; pool != currentPool->next; pool = pool->next){
+        ++count;
+    }
+    for(compactionTableSize = 1; compactionTableSize < 2 * count; compactionTableSize *= 2);
+    compactions = (struct Compaction **)malloc(count * sizeof(struct Compaction *));
+    compactionTable = (struct Compaction **)calloc(compactionTableSize, sizeof(struct Compaction *));
+    if(!compactions || !compactionTable){
+        perror("malloc");
+        abort();
+    }
+    for(i = 0, pool = poolList; i < count; ++i, pool = pool->next){
+        c = (struct Compaction *)calloc(1, sizeof(struct Compaction));
+        if(!c){
+            perror("calloc");
+            abort();
+        }
+        c->pool = pool;
+        c->end = pool->memSpace;
+        compactions[i] = c;
+        for(j = ((ggc_size_t)pool >> GGGGC_POOL_SIZE) & (compactionTableSize - 1); compactionTable[j];
+            j = (j + 1) & (compactionTableSize - 1));
+        compactionTable[j] = c;
+    }
+
+    last = planCompaction(count);
+    forwardOutside();
+    for(i = 0; i < count; ++i){
+        pool = compactions[i]->pool;
+        for(j = MARK_INDEX(pool->memSpace) / GGGGC_BITS_PER_WORD; j <= MARK_INDEX(pool->endptr - 1) / GGGGC_BITS_PER_WORD; ++j){
+            bits = pool->markBits[j];
+            while(bits){
+                forwardFields((ggc_size_t *)pool + j * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+    for(i = 0; i < count; ++i){
+        slidePool(compactions[i]);
+    }
+
+    // Free memory is kept zeroed, so clear what was left behind. The pools
+    // before the last one with anything in it are full, so their ends go on
+    // the free lists, and it's bump allocated from. The ones after it are
+    // empty, and may be given back.
+    prev = NULL;
+    for(i = 0, pool = poolList; pool; ++i, pool = next){
+        next = pool->next;
+        if(i < count){
+            c = compactions[i];
+            live += c->end - pool->memSpace;
+            if(pool->endptr > c->end){
+                memset(c->end, 0, (pool->endptr - c->end) * sizeof(ggc_size_t));
+            }
+            pool->endptr = c->end;
+            free(c);
+        }
+        if(i < last){
+            retirePool(pool);
+        }
+        else if(i == last){
+            currentPool = pool;
+        }
+        else if(shouldReleasePool()){
+            if(prev){
+                prev->next = next;
+            }
+            else{
+                poolList = next;
+            }
+            releasePool(pool);
+            continue;
+        }
+        prev = pool;
+    }
+    lastPool = prev;
+
+    free(compactions);
+    free(compactionTable);
+    compactions = compactionTable = NULL;
+    compactionTableSize = 0;
+    return live;
+}
+
+/*
+    Collections are generational, with sticky mark bits: mark bits aren't
+    cleared by the sweep, so every object that survives a collection stays
+    marked, and is old from then on. A minor collection (gen 0) marks only
+    young objects, starting from the roots and from old objects on dirty
+    cards, and stops wherever it finds an old one. Anything unmarked after
+    that is garbage. A major collection (gen 1) clears the mark bits first,
+    and so marks the whole heap; minor collections become major ones when
+    the old objects have grown MAJOR_GROWTH times over since the last major
+    one, or after MAJOR_INTERVAL minor ones. Since objects only move when the
+    heap is compacted, the "nursery" is just whatever was allocated since the
+    last collection. Incremental collections (see markSlice) are always
+    major, as are compacting ones (see compactHeap).
+*/
+
+// Run a collection, minor for gen 0
+static void collect0(unsigned char gen){
+    collect(gen, GGGGC_COLLECT_EXPLICIT);
+}
+
+// Run a collection, and grow the heap after it as sizeHeap sees fit
+static void collect(unsigned char gen, enum GGGGC_CollectionReason reason)
+{
+    unsigned long long start = nowNs();
+    struct GGGGC_CollectionStats *record = &stats.last;
+    ggc_size_t live;
+    int compact = shouldCompact();
+
+    record->number = stats.collections + 1;
+    record->reason = reason;
+    record->freeListBytes = freeListWords * sizeof(ggc_size_t);
+    record->freeListBlocks = freeListBlocks;
+    record->poolsBefore = available / (POOL_SIZE / sizeof(ggc_size_t));
+    record->bytesFreed = largeBytes;
+    record->bytesCompacted = 0;
+
+    if(ggggc_incrementalMarking){
+        // an incremental collection is under way, so just finish it
+        markFromStack(0);
+        ggggc_incrementalMarking = 0;
+        gen = 1;
+    }
+    else{
+        // old garbage is only found by a major collection, so have one once
+        // the old objects have grown enough since the last
+        if(compact || oldWords > MAJOR_GROWTH * majorOldWords || minorCount >= MAJOR_INTERVAL){
+            gen = 1;
+        }
+        beginMarking(gen);
+        #ifdef CHATTY
+        printf("GC / Mark phase\n");
+        #endif
+#ifdef PARALLEL_MARK
+        if(markThreads == 0){
+            initParallelMark();
+        }
+        if(markThreads > 1){
+            markRootCount = 0;
+            pushRoots(markRootPush, NULL);
+            pushPermanentCards(markRootPush, NULL);
+            if(!gen){
+                pushCards(markRootPush, NULL);
+            }
+            markParallel();
+        }
+        else
+#endif
+        {
+            pushRoots(toSearchPush, &markStack);
+            pushPermanentCards(toSearchPush, &markStack);
+            if(!gen){
+                pushCards(toSearchPush, &markStack);
+            }
+            markFromStack(0);
+        }
+    }
+    live = oldWords + markedWords;
+    sizeHeap(nowNs() - start + sliceNs, live);
+    stats.bytesAllocated += (allocated - lastAllocated + largeAllocated) * sizeof(ggc_size_t);
+    record->bytesFreed += (allocated - live) * sizeof(ggc_size_t);
+    oldWords = allocated = live;
+    clearCards();
+    sweepLarge();
+    largeAllocated = 0;
+    record->bytesFreed -= largeBytes;
+
+    // The free lists are rebuilt from scratch as pools are swept. Pools
+    // before currentPool are swept lazily, as the allocator needs them.
+    // currentPool is being bump allocated into, so it's swept now, and the
+    // pools after it are fresh. A compacted heap needs no sweeping.
+    memset(freeLists, 0, sizeof(freeLists));
+    freeListsUsed = 0;
+    freeListWords = freeListBlocks = fragmentWords = 0;
+    sweepPrev = NULL;
+    if(compact){
+        sweepNext = sweepEnd = NULL;
+        record->bytesCompacted = compactHeap() * sizeof(ggc_size_t);
+        ++stats.compactions;
+    }
+    else{
+        sweepNext = poolList;
+        sweepEnd = currentPool;
+        if(currentPool){
+            sweepPool(currentPool);
+        }
+    }
+    growHeap();
+    lastCollectionEnd = nowNs();
+    lastAllocated = allocated;
+
+    // and record it
+    record->major = gen;
+    record->pauseNs = lastCollectionEnd - start;
+    record->sliceNs = sliceNs;
+    record->roots = rootsScanned;
+    record->bytesMarked = markedWords * sizeof(ggc_size_t);
+    record->poolsAfter = available / (POOL_SIZE / sizeof(ggc_size_t));
+    ++stats.collections;
+    stats.majorCollections += gen != 0;
+    stats.totalPauseNs += record->pauseNs;
+    if(record->pauseNs > stats.maxPauseNs){
+        stats.maxPauseNs = record->pauseNs;
+    }
+    sliceNs = 0;
+    rootsScanned = 0;
+    if(collectionHook){
+        collectionHook(record);
+    }
+
+    if(gen || !majorOldWords){
+        majorOldWords = oldWords;
+        minorCount = 0;
+    }
+    else{
+        ++minorCount;
+    }
+}
+
+/* get the collector's statistics */
+void ggggc_getStats(struct GGGGC_Stats *out)
+{
+    *out = stats;
+    out->bytesAllocated += (allocated - lastAllocated + largeAllocated) * sizeof(ggc_size_t);
+    out->heapBytes = available * sizeof(ggc_size_t);
+    out->largeBytes = largeBytes;
+    out->liveBytes = oldWords * sizeof(ggc_size_t);
+    out->permanentBytes = permanentWords * sizeof(ggc_size_t);
+}
+
+/* set a function to be called after each collection */
+void ggggc_setCollectionHook(ggggc_collection_hook_t hook)
+{
+    collectionHook = hook;
+}
+
+// Walk the heap, once a full collection has left only live objects in it
+static void walkHeap(ggggc_heap_visitor_t visit, void *arg){
+    struct Pool *pool;
+    struct LargeObject *lo;
+    struct GGGGC_Descriptor *descriptor;
+    ggc_size_t *pointer, *end, words;
+
+    collect(1, GGGGC_COLLECT_SNAPSHOT);
+    // swept, every pool is parsable up to its endptr, and the rest is unused
+    finishSweeping();
+    for(pool = poolList; pool; pool = pool->next){
+        pointer = pool->memSpace;
+        while(pointer < pool->endptr){
+            if(testFree(pointer)){
+                words = ((struct FreeObjHeader *)pointer)->size;
+                visit(arg, pointer, NULL, words * sizeof(ggc_size_t));
+            }
+            else{
+                descriptor = (struct GGGGC_Descriptor *)(*pointer);
+                words = MAX(descriptor->size, MIN_BLOCK);
+                visit(arg, pointer, descriptor, words * sizeof(ggc_size_t));
+            }
+            pointer += words;
+        }
+        end = (ggc_size_t *)((unsigned char *)(pool->memSpace) + POOL_SIZE);
+        if(pool->endptr < end){
+            visit(arg, pool->endptr, NULL, (end - pool->endptr) * sizeof(ggc_size_t));
+        }
+    }
+    for(lo = largeObjects; lo; lo = lo->next){
+        descriptor = (struct GGGGC_Descriptor *)(lo->memSpace[0]);
+        visit(arg, lo->memSpace, descriptor, descriptor->size * sizeof(ggc_size_t));
+    }
+    // permanent pools are all objects up to their endptr
+    for(pool = permanentPools; pool; pool = pool->next){
+        for(pointer = pool->memSpace; pointer < pool->endptr; pointer += words){
+            descriptor = (struct GGGGC_Descriptor *)(*pointer);
+            words = MAX(descriptor->size, MIN_BLOCK);
+            visit(arg, pointer, descriptor, words * sizeof(ggc_size_t));
+        }
+    }
+}
+
+// Pass every root to visit, without counting them as a collection's
+static void walkRoots(ggggc_pointer_visitor_t visit, void *arg){
+    ggc_size_t scanned = rootsScanned;
+    pushRoots(visit, arg);
+    rootsScanned = scanned;
+}
+
+// Pass every pointer in an object to visit. Unlike scanFields, this doesn't
+// skip marked descriptors, since after a collection they all are.
+void ggggc_walkObject(void *obj, ggggc_pointer_visitor_t visit, void *arg)
+{
+    ggc_size_t *pointer = (ggc_size_t *)obj;
+    struct GGGGC_Descriptor *descriptor = (struct GGGGC_Descriptor *)(*pointer);
+    ggc_size_t word, words, bits;
+    void *child;
+
+    visit(arg, descriptor);
+    if(!(descriptor->pointers[0] & 1)){
+        return;
+    }
+    words = GGGGC_DESCRIPTOR_WORDS_REQ(descriptor->size);
+    for(word = 0; word < words; ++word){
+        bits = descriptor->pointers[word];
+        if(word == 0){
+            bits &= ~(ggc_size_t)1;
+        }
+        if(word == words - 1 && descriptor->size % GGGGC_BITS_PER_WORD){
+            bits &= ((ggc_size_t)1 << (descriptor->size % GGGGC_BITS_PER_WORD)) - 1;
+        }
+        while(bits){
+            child = (void *)pointer[word * GGGGC_BITS_PER_WORD + __builtin_ctzl(bits)];
+            bits &= bits - 1;
+            if(child){
+                visit(arg, child);
+            }
+        }
+    }
+}
+
+const struct GGGGC_Collector ggggc_collectorMS = {
+    "ms",
+    1,
+    mallocRaw,
+    collect0,
+    yield,
+    mallocRawPermanent,
+    isPermanent,
+    walkHeap,
+    walkRoots
+};
@@ -65,7 +65,7 @@ int main(){
     head = append(0, head, ListNode_Descriptor);
     printf("list head at %p\n", head);
     printf("descriptor for list head: %p\n", head->header.descriptor__ptr);
-    GGC_PUSH_1(head);
+    GGC_PUSH_2(head, ListNode_Descriptor);
     for(ggc_size_t i = 1; i < 100; ++i){
         printf("Append node %u\n", i);
         append(i, head, ListNode_Descriptor);
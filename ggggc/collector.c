@@ -0,0 +1,164 @@
+/*
+ * Selecting a collector at runtime
+ *
+ * Copyright (c) 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#ifdef GGGGC_DEBUG_NO_GC
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+#include "ggggc/gc.h"
+#include "ggggc-internals.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* every collector built in, the first being the default */
+static const struct GGGGC_Collector *collectors[] = {
+    &ggggc_collectorMS,
+    &ggggc_collectorGembc,
+    NULL
+};
+
+const struct GGGGC_Collector *ggggc_collector = &ggggc_collectorMS;
+
+/* catch allocation and collection where GGC_NO_GC() says there is none */
+#ifdef GGGGC_DEBUG_NO_GC
+#define NO_GC_CHECK(what) do { \
+    if (ggggc_noGC) { \
+        fprintf(stderr, "GGGGC: %s inside GGC_NO_GC()\n", (what)); \
+        abort(); \
+    } \
+} while(0)
+#else
+#define NO_GC_CHECK(what) do {} while(0)
+#endif
+
+/* choose the collector by name */
+int ggggc_setCollector(const char *name)
+{
+    const struct GGGGC_Collector **collector;
+    for (collector = collectors; *collector; collector++) {
+        if (!strcmp((*collector)->name, name)) {
+            ggggc_collector = *collector;
+            ggggc_cardMarking = ggggc_collector->cardMarking;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* the name of the collector in use */
+const char *ggggc_collectorName()
+{
+    return ggggc_collector->name;
+}
+
+/* the rest just pass on to the collector */
+void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, ggc_size_t size)
+{
+    NO_GC_CHECK("allocation");
+    return ggggc_collector->mallocRaw(descriptor, size);
+}
+
+/* allocate an object */
+void *ggggc_malloc(struct GGGGC_Descriptor *descriptor)
+{
+    struct GGGGC_Header *ret;
+    NO_GC_CHECK("allocation");
+    ret = (struct GGGGC_Header *) ggggc_collector->mallocRaw(&descriptor, descriptor->size);
+    ret->descriptor__ptr = descriptor;
+    return ret;
+}
+
+/* run a collection */
+void ggggc_collect0(unsigned char gen)
+{
+    NO_GC_CHECK("collection");
+    ggggc_collector->collect(gen);
+}
+
+/* explicitly yield to the collector */
+int ggggc_yield()
+{
+    NO_GC_CHECK("collection");
+    return ggggc_collector->yield();
+}
+
+/* without a permanent space, permanent objects just go in the heap */
+void *ggggc_mallocRawPermanent(struct GGGGC_Descriptor **descriptor, ggc_size_t size)
+{
+    NO_GC_CHECK("allocation");
+    if (ggggc_collector->mallocRawPermanent)
+        return ggggc_collector->mallocRawPermanent(descriptor, size);
+    return ggggc_collector->mallocRaw(descriptor, size);
+}
+
+/* allocate an object in permanent space */
+void *ggggc_mallocPermanent(struct GGGGC_Descriptor *descriptor)
+{
+    struct GGGGC_Header *ret = (struct GGGGC_Header *) ggggc_mallocRawPermanent(&descriptor, descriptor->size);
+    ret->descriptor__ptr = descriptor;
+    return ret;
+}
+
+/* whether this points into permanent space */
+int ggggc_isPermanent(void *ptr)
+{
+    return ggggc_collector->isPermanent && ggggc_collector->isPermanent(ptr);
+}
+
+/* copy an object into permanent space. Without one, the object is as
+ * permanent as it gets already. */
+void *ggggc_copyPermanent(void *obj)
+{
+    struct GGGGC_Descriptor *descriptor;
+    void *ret;
+
+    if (!obj || !ggggc_collector->mallocRawPermanent || ggggc_isPermanent(obj))
+        return obj;
+
+    descriptor = ((struct GGGGC_Header *) obj)->descriptor__ptr;
+    GGC_PUSH_1(obj);
+    ret = ggggc_collector->mallocRawPermanent(&descriptor, descriptor->size);
+    GGC_POP();
+
+    /* the copy's pointers go in without a barrier, but the collector starts
+     * new permanent objects off remembered */
+    memcpy(ret, obj, descriptor->size * sizeof(ggc_size_t));
+    return ret;
+}
+
+/* walk the heap, if the collector can */
+void ggggc_walkHeap(ggggc_heap_visitor_t visit, void *arg)
+{
+    if (ggggc_collector->walkHeap)
+        ggggc_collector->walkHeap(visit, arg);
+}
+
+void ggggc_walkRoots(ggggc_pointer_visitor_t visit, void *arg)
+{
+    if (ggggc_collector->walkRoots)
+        ggggc_collector->walkRoots(visit, arg);
+}
+
+#ifdef __cplusplus
+}
+#endif
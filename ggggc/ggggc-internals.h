@@ -29,6 +29,30 @@ extern "C" {
  * only */
 void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, ggc_size_t size);
 
+/* allocate an object in permanent space (see ggggc_mallocPermanent) */
+void *ggggc_mallocRawPermanent(struct GGGGC_Descriptor **descriptor, ggc_size_t size);
+
+/* a collector, as selected by ggggc_setCollector. mallocRaw, collect and
+ * yield are required. A collector without a permanent space leaves
+ * mallocRawPermanent and isPermanent NULL, and one that can't walk its heap
+ * leaves walkHeap and walkRoots NULL. */
+struct GGGGC_Collector {
+    const char *name;
+    int cardMarking; /* whether writes to marked objects dirty their cards */
+    void *(*mallocRaw)(struct GGGGC_Descriptor **descriptor, ggc_size_t size);
+    void (*collect)(unsigned char gen);
+    int (*yield)(void);
+    void *(*mallocRawPermanent)(struct GGGGC_Descriptor **descriptor, ggc_size_t size);
+    int (*isPermanent)(void *ptr);
+    void (*walkHeap)(ggggc_heap_visitor_t visit, void *arg);
+    void (*walkRoots)(ggggc_pointer_visitor_t visit, void *arg);
+};
+
+/* the collectors built in, and the one in use */
+extern const struct GGGGC_Collector ggggc_collectorMS;
+extern const struct GGGGC_Collector ggggc_collectorGembc;
+extern const struct GGGGC_Collector *ggggc_collector;
+
 /* allocate and initialize a pool */
 struct GGGGC_Pool *ggggc_newPool(int mustSucceed);
 
@@ -84,6 +108,15 @@ struct GGGGC_JITPointerStackList {
 };
 extern struct GGGGC_JITPointerStackList *ggggc_rootJITPointerStackList;
 
+/* walk the live slots of a JIT pointer stack, frame by frame:
+ * for (slot = ggggc_jitStackFirst(&walk, jpsl); slot; slot = ggggc_jitStackNext(&walk)) */
+struct GGGGC_JITStackWalk {
+    void **frame, **top;
+    ggc_size_t i;
+};
+void **ggggc_jitStackFirst(struct GGGGC_JITStackWalk *walk, struct GGGGC_JITPointerStackList *jpsl);
+void **ggggc_jitStackNext(struct GGGGC_JITStackWalk *walk);
+
 /* threads which are blocked need to store their roots and pools aside when they can't stop the world */
 extern struct GGGGC_PoolList *ggggc_blockedThreadPool0s;
 extern struct GGGGC_PointerStackList *ggggc_blockedThreadPointerStacks;
@@ -107,6 +140,12 @@ extern struct GGGGC_Descriptor *ggggc_descriptorDescriptors[GGGGC_WORDS_PER_POOL
 /* and a lock for the descriptor descriptors */
 extern ggc_mutex_t ggggc_descriptorDescriptorsLock;
 
+/* shared descriptors for small pointer and data arrays, indexed by size in
+ * words. Protected by the descriptor descriptor lock. */
+#define GGGGC_ARRAY_DESCRIPTORS 1024
+extern struct GGGGC_Descriptor *ggggc_descriptorsPA[GGGGC_ARRAY_DESCRIPTORS];
+extern struct GGGGC_Descriptor *ggggc_descriptorsDA[GGGGC_ARRAY_DESCRIPTORS];
+
 #ifdef __cplusplus
 }
 #endif
@@ -63,9 +63,35 @@
     (object)->member = (value); \
 } while(0)
 #else
+/* set while the collector is marking incrementally */
+extern volatile int ggggc_incrementalMarking;
+
+/* snapshot-at-the-beginning barrier: the pointer being overwritten was
+ * reachable when marking started, so the collector must still see it */
+void ggggc_markBarrier(void *old);
+
+/* set when the collector in use has card tables (see ggggc_setCollector) */
+extern int ggggc_cardMarking;
+
+/* with collector-ms, each pool starts with a card table and then a mark
+ * bitmap, one bit per word. Marked objects are old, and writing to one dirties
+ * the card holding its header. */
+#define GGGGC_CARD_TABLE(pool) ((unsigned char *) (pool))
+#define GGGGC_MARK_BITS(pool) ((ggc_size_t *) ((unsigned char *) (pool) + GGGGC_CARDS_PER_POOL))
+#define GGGGC_MARK_INDEX(ptr) (((ggc_size_t) (ptr) & GGGGC_POOL_INNER_MASK) / sizeof(ggc_size_t))
+#define GGGGC_IS_MARKED(ptr) \
+    ((GGGGC_MARK_BITS(GGGGC_POOL_OF(ptr))[GGGGC_MARK_INDEX(ptr) / GGGGC_BITS_PER_WORD] >> \
+      (GGGGC_MARK_INDEX(ptr) % GGGGC_BITS_PER_WORD)) & 1)
+
 #define GGGGC_WP(object, member, value) do { \
     GGGGC_ASSERT_ID(object); \
     GGGGC_ASSERT_ID(value); \
+    if (ggggc_incrementalMarking) { \
+        void *ggggc_old = (void *) (object)->member; \
+        if (ggggc_old) ggggc_markBarrier(ggggc_old); \
+    } \
+    if (ggggc_cardMarking && GGGGC_IS_MARKED(object)) \
+        GGGGC_CARD_TABLE(GGGGC_POOL_OF(object))[GGGGC_CARD_OF(object)] = 1; \
     (object)->member = (value); \
 } while(0)
 #endif
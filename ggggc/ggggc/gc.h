@@ -39,6 +39,8 @@ extern "C" {
 #define GGGGC_DEBUG_MEMORY_CORRUPTION 1
 #define GGGGC_DEBUG_REPORT_COLLECTIONS 1
 #define GGGGC_DEBUG_TINY_HEAP 1
+#define GGGGC_DEBUG_JIT_STACK 1
+#define GGGGC_DEBUG_NO_GC 1
 #endif
 
 /* flags to disable GCC features */
@@ -129,6 +131,7 @@ struct GGGGC_Header {
 struct GGGGC_Descriptor {
     struct GGGGC_Header header;
     void *user__ptr; /* for the user to use however they please */
+    ggc_size_t user__data; /* likewise, for data which isn't a pointer */
     ggc_size_t size; /* size of the described object in words */
     ggc_size_t pointers[1]; /* location of pointers within the object (as a special
                          * case, if pointers[0]&1==0, this means "no pointers") */
@@ -255,12 +258,20 @@ static type ## __descriptorSlotConstructor type ## __descriptorSlotConstructorIn
     GGGGC_WP(ggggc_desc, user__ptr, value); \
 } while(0)
 
+/* write the descriptor user data word */
+#define GGC_WUD(object, value) do { \
+    struct GGGGC_Descriptor *ggggc_desc = (object)->header.descriptor__ptr; \
+    GGGGC_ASSERT_ID(object); \
+    GGGGC_WD(ggggc_desc, user__data, value); \
+} while(0)
+
 /* although pointers don't need a read barrier, the renaming sort of forces one */
 #define GGC_RP(object, member)  GGGGC_RP(object, member ## __ptr)
 #define GGC_RD(object, member)  GGGGC_RD(object, member ## __data)
 #define GGC_RAP(object, index)  GGGGC_RP(object, a__ptrs[(index)])
 #define GGC_RAD(object, index)  GGGGC_RD(object, a__data[(index)])
 #define GGC_RUP(object)         ((object)->header.descriptor__ptr->user__ptr)
+#define GGC_RUD(object)         ((object)->header.descriptor__ptr->user__data)
 #define GGC_LENGTH(object)      ((object)->header.descriptor__ptr->length)
 
 /* because the write barrier forces you to use identifiers, an identifier version of NULL */
@@ -280,6 +291,19 @@ void *ggggc_mallocSlot(struct GGGGC_DescriptorSlot *slot);
 #define GGC_NEW(type) ((type) ggggc_mallocSlot(&type ## __descriptorSlot))
 #endif
 
+/* permanent space, for objects that will never die (parsed code, compiled
+ * code, types). Nothing in it is ever freed or traced by the collector, but
+ * pointers from it into the heap are remembered, so permanent objects may
+ * point anywhere, and are written with the usual barriers. Objects are
+ * allocated zeroed like any other, or copied from the heap, in which case the
+ * original should be rooted (a very large object may have to be copied into
+ * the ordinary heap instead). */
+void *ggggc_mallocPermanent(struct GGGGC_Descriptor *descriptor);
+void *ggggc_copyPermanent(void *obj);
+int ggggc_isPermanent(void *ptr);
+#define GGC_NEW_PERMANENT(type) \
+    ((type) ggggc_mallocPermanent(ggggc_allocateDescriptorSlot(&type ## __descriptorSlot)))
+
 /* allocate a pointer array (size is in words) */
 void *ggggc_mallocPointerArray(ggc_size_t sz);
 #define GGC_NEW_PA(type, size) \
@@ -298,6 +322,9 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptor(ggc_size_t size, ggc_size_t po
  * pointers */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_size_t *pointers);
 
+/* the same, for a descriptor in permanent space */
+struct GGGGC_Descriptor *ggggc_allocatePermanentDescriptorL(ggc_size_t size, const ggc_size_t *pointers);
+
 /* descriptor allocator for pointer arrays */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorPA(ggc_size_t size);
 
@@ -307,6 +334,89 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorDA(ggc_size_t size);
 /* allocate a descriptor from a descriptor slot */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorSlot(struct GGGGC_DescriptorSlot *slot);
 
+/* choose the collector by name: "ms" (the default) or "gembc". This must be
+ * done before anything is allocated. Returns -1 if there's no such collector.
+ * The heap policy, statistics, hooks, heap walking and permanent space below
+ * are collector-ms's, and the others go without. */
+int ggggc_setCollector(const char *name);
+const char *ggggc_collectorName(void);
+
+/* set the maximum heap size in bytes (0 for no limit) and the share of time
+ * to spend collecting (e.g. 0.05, or 0 to leave it be). These default to
+ * GGGGC_MAX_HEAP and GGGGC_GC_OVERHEAD from the environment. */
+void ggggc_setHeapPolicy(ggc_size_t maxHeap, double gcOverhead);
+
+/* why a collection ran */
+enum GGGGC_CollectionReason {
+    GGGGC_COLLECT_EXPLICIT,     /* ggggc_collect0 was called directly */
+    GGGGC_COLLECT_ALLOCATION,   /* an allocation didn't fit */
+    GGGGC_COLLECT_YIELD,        /* ggggc_yield found the heap full enough */
+    GGGGC_COLLECT_LARGE,        /* large objects used up their share */
+    GGGGC_COLLECT_INCREMENTAL,  /* incremental marking finished */
+    GGGGC_COLLECT_LIMIT,        /* an allocation didn't fit at the heap limit */
+    GGGGC_COLLECT_SNAPSHOT      /* ggggc_walkHeap needed only live objects */
+};
+
+/* a record of one collection */
+struct GGGGC_CollectionStats {
+    unsigned long long number;  /* 1 for the first collection */
+    enum GGGGC_CollectionReason reason;
+    int major;
+    unsigned long long pauseNs; /* time the world was stopped */
+    unsigned long long sliceNs; /* time in incremental slices before that */
+    ggc_size_t roots;           /* roots scanned */
+    ggc_size_t bytesMarked;     /* bytes marked live */
+    ggc_size_t bytesFreed;      /* bytes found dead */
+    ggc_size_t freeListBytes;   /* bytes on the free lists when it began, */
+    ggc_size_t freeListBlocks;  /* and how many blocks they were in */
+    ggc_size_t poolsBefore;     /* pools in the heap before, */
+    ggc_size_t poolsAfter;      /* and after it was resized */
+    ggc_size_t bytesCompacted;  /* bytes of objects slid down, if it compacted */
+};
+
+/* totals since the program started */
+struct GGGGC_Stats {
+    unsigned long long collections;
+    unsigned long long majorCollections;
+    unsigned long long compactions;
+    unsigned long long totalPauseNs;
+    unsigned long long maxPauseNs;
+    unsigned long long bytesAllocated;
+    ggc_size_t heapBytes;       /* in pools */
+    ggc_size_t largeBytes;      /* in large objects */
+    ggc_size_t liveBytes;       /* as of the last collection */
+    ggc_size_t permanentBytes;  /* in permanent space */
+    struct GGGGC_CollectionStats last;
+};
+
+/* get the collector's statistics */
+void ggggc_getStats(struct GGGGC_Stats *stats);
+
+/* set a function to be called after each collection (NULL for none). It must
+ * not allocate. */
+typedef void (*ggggc_collection_hook_t)(const struct GGGGC_CollectionStats *stats);
+void ggggc_setCollectionHook(ggggc_collection_hook_t hook);
+
+/* sample allocations: about once every interval bytes allocated, hook is
+ * called with the new object's descriptor (NULL if it has none), its size in
+ * bytes, and how many bytes of allocation the sample stands for. The object
+ * isn't initialized yet, and the hook must not allocate. An interval of 0
+ * turns sampling off. */
+typedef void (*ggggc_allocation_hook_t)(struct GGGGC_Descriptor *descriptor, ggc_size_t bytes, ggc_size_t weight);
+void ggggc_setAllocationSampler(ggc_size_t interval, ggggc_allocation_hook_t hook);
+
+/* heap inspection, for snapshots. ggggc_walkHeap collects fully, then calls
+ * visit for every object in the heap (all of them live) with its descriptor
+ * and size in bytes, and for every block of free space with a NULL
+ * descriptor, then for every object in permanent space. ggggc_walkRoots calls visit for every root, and
+ * ggggc_walkObject for every non-NULL pointer in an object, its descriptor
+ * included. Visitors must not allocate. */
+typedef void (*ggggc_heap_visitor_t)(void *arg, void *obj, struct GGGGC_Descriptor *descriptor, ggc_size_t bytes);
+typedef void (*ggggc_pointer_visitor_t)(void *arg, void *ptr);
+void ggggc_walkHeap(ggggc_heap_visitor_t visit, void *arg);
+void ggggc_walkRoots(ggggc_pointer_visitor_t visit, void *arg);
+void ggggc_walkObject(void *obj, ggggc_pointer_visitor_t visit, void *arg);
+
 /* global heuristic for "please stop the world" */
 extern volatile int ggggc_stopTheWorld;
 
@@ -316,6 +426,21 @@ extern volatile int ggggc_stopTheWorld;
 int ggggc_yield(void);
 #define GGC_YIELD() (ggggc_stopTheWorld ? ggggc_yield() : 0)
 
+/* [nogc] code which never allocates, so nothing can be collected or moved
+ * while it runs, needn't push its pointers. It can say so with GGC_NO_GC()
+ * after its declarations, and with GGGGC_DEBUG_NO_GC, allocating or
+ * collecting before it returns aborts. */
+extern ggc_thread_local int ggggc_noGC;
+#if defined(GGGGC_DEBUG_NO_GC) && defined(__GNUC__) && !defined(GGGGC_NO_GNUC_CLEANUP)
+static inline void ggggc_noGCEnd(int *i) {
+    ggggc_noGC--;
+}
+#define GGC_NO_GC() \
+    int __attribute__((cleanup(ggggc_noGCEnd))) __attribute__((unused)) ggggc_noGCScope = ggggc_noGC++
+#else
+#define GGC_NO_GC() do {} while(0)
+#endif
+
 /* to handle global variables, GGC_PUSH them then GGC_GLOBALIZE */
 void ggggc_globalize(void);
 #define GGC_GLOBALIZE() ggggc_globalize()
@@ -326,6 +451,26 @@ extern ggc_thread_local struct GGGGC_PointerStack *ggggc_pointerStack, *ggggc_po
 /* [jitpstack] and a pointer stack for JIT purposes */
 extern ggc_thread_local void **ggc_jitPointerStack, **ggc_jitPointerStackTop;
 
+/* The JIT pointer stack is a sequence of frames, from ggc_jitPointerStack up
+ * to ggc_jitPointerStackTop. The first word of each frame points to the stack
+ * map for the call the frame is stopped at, which gives the frame's size in
+ * words and which of its words hold live pointers. Only those are scanned, so
+ * the rest of the frame needn't be initialized. Stack maps are not collected. */
+struct GGGGC_JITStackMap {
+    ggc_size_t size;
+    ggc_size_t live[1];
+};
+#define GGGGC_JIT_STACK_MAP_BYTES(size) \
+    (sizeof(struct GGGGC_JITStackMap) + \
+     (GGGGC_DESCRIPTOR_WORDS_REQ(size) - 1) * sizeof(ggc_size_t))
+
+#ifdef GGGGC_DEBUG_JIT_STACK
+/* with GGGGC_DEBUG_JIT_STACK, the JIT fills the words of a new frame that no
+ * map lists yet with this, and the GC aborts if a map lists one still holding
+ * it */
+#define GGGGC_JIT_STACK_POISON ((void *) (ggc_size_t) 0xBADF00D)
+#endif
+
 /* macros to push and pop pointers from the pointer stack */
 #define GGGGC_POP() do { \
     ggggc_pointerStack = ggggc_pointerStack->next; \
@@ -3,6 +3,12 @@
 /* publics */
 ggc_thread_local struct GGGGC_PointerStack *ggggc_pointerStack, *ggggc_pointerStackGlobals;
 ggc_thread_local void **ggc_jitPointerStack, **ggc_jitPointerStackTop;
+ggc_thread_local int ggggc_noGC;
+
+#if GGGGC_GENERATIONS == 1
+volatile int ggggc_incrementalMarking;
+int ggggc_cardMarking = 1;
+#endif
 
 /* internals */
 volatile int ggggc_stopTheWorld;
@@ -22,3 +28,5 @@ struct GGGGC_Pool *ggggc_gens[GGGGC_GENERATIONS];
 struct GGGGC_Pool *ggggc_pools[GGGGC_GENERATIONS];
 struct GGGGC_Descriptor *ggggc_descriptorDescriptors[GGGGC_WORDS_PER_POOL/GGGGC_BITS_PER_WORD+sizeof(struct GGGGC_Descriptor)];
 ggc_mutex_t ggggc_descriptorDescriptorsLock;
+struct GGGGC_Descriptor *ggggc_descriptorsPA[GGGGC_ARRAY_DESCRIPTORS];
+struct GGGGC_Descriptor *ggggc_descriptorsDA[GGGGC_ARRAY_DESCRIPTORS];
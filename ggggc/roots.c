@@ -22,6 +22,7 @@
 #include <sys/types.h>
 
 #include "ggggc/gc.h"
+#include "ggggc-internals.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -50,6 +51,46 @@ void ggggc_globalize()
     ggggc_pointerStackGlobals = gPointerStack;
 }
 
+/* start walking the live slots of a JIT pointer stack, returning the first */
+void **ggggc_jitStackFirst(struct GGGGC_JITStackWalk *walk, struct GGGGC_JITPointerStackList *jpsl)
+{
+    walk->frame = jpsl->cur;
+    walk->top = jpsl->top;
+    walk->i = 0;
+    return ggggc_jitStackNext(walk);
+}
+
+/* the next live slot of a JIT pointer stack, or NULL at the top */
+void **ggggc_jitStackNext(struct GGGGC_JITStackWalk *walk)
+{
+    struct GGGGC_JITStackMap *map;
+    ggc_size_t i;
+
+    while (walk->frame < walk->top) {
+        /* the first word of the frame is its map, never a live slot */
+        map = (struct GGGGC_JITStackMap *) walk->frame[0];
+        for (i = walk->i + 1; i < map->size; i++) {
+            if (map->live[i / GGGGC_BITS_PER_WORD] & ((ggc_size_t) 1 << (i % GGGGC_BITS_PER_WORD))) {
+#ifdef GGGGC_DEBUG_JIT_STACK
+                if (walk->frame[i] == GGGGC_JIT_STACK_POISON) {
+                    fprintf(stderr, "GGGGC: JIT stack map lists word %lu of a frame, "
+                        "which nothing has been stored to!\n", (unsigned long) i);
+                    abort();
+                }
+#endif
+                walk->i = i;
+                return walk->frame + i;
+            }
+        }
+
+        /* on to the caller's frame */
+        walk->frame += map->size;
+        walk->i = 0;
+    }
+
+    return NULL;
+}
+
 #ifdef __cplusplus
 }
 #endif
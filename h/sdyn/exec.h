@@ -19,7 +19,8 @@
 #ifndef SDYN_EXEC_H
 #define SDYN_EXEC_H 1
 
-/* execute this code */
-void sdyn_exec(const unsigned char *code);
+/* execute this code. A program's own code is permanent: its parse tree and IR
+ * are moved to the collector's permanent space, and never traced again */
+void sdyn_exec(const unsigned char *code, int permanent);
 
 #endif
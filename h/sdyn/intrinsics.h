@@ -26,6 +26,11 @@
 sdyn_native_function_t sdyn_getIntrinsic(SDyn_String intrinsic);
 
 SDyn_Undefined sdyn_iEval(void **pstack, size_t argCt, SDyn_Undefined *args);
+SDyn_Undefined sdyn_iGCStats(void **pstack, size_t argCt, SDyn_Undefined *args);
+SDyn_Undefined sdyn_iHeapSnapshot(void **pstack, size_t argCt, SDyn_Undefined *args);
 SDyn_Undefined sdyn_iPrint(void **pstack, size_t argCt, SDyn_Undefined *args);
 
+/* log every collection to the file named by SDYN_GC_LOG, if it's set */
+void sdyn_initGCLog(void);
+
 #endif
@@ -57,9 +57,11 @@ GGC_TYPE(SDyn_IRNode)
     GGC_MDATA(size_t, addr); /* the address this value is assigned to */
     GGC_MDATA(size_t, uidx); /* the index after unification */
     GGC_MPTR(GGC_size_t_Array, lastUsed); /* values used no later than here */
+    GGC_MPTR(GGC_char_Array, live); /* pointer stack slots holding values as this begins */
 GGC_END_TYPE(SDyn_IRNode,
     GGC_PTR(SDyn_IRNode, immp)
     GGC_PTR(SDyn_IRNode, lastUsed)
+    GGC_PTR(SDyn_IRNode, live)
     );
 
 /* compile a function to IR */
@@ -35,4 +35,7 @@ GGC_END_TYPE(SDyn_Node,
 /* the parser entry point */
 SDyn_Node sdyn_parse(const unsigned char *inp);
 
+/* copy a parse tree into permanent space */
+SDyn_Node sdyn_permanentNode(SDyn_Node node);
+
 #endif
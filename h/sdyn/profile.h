@@ -0,0 +1,47 @@
+/*
+ * SDyn: Sampling allocation profiler
+ *
+ * Copyright (c) 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDYN_PROFILE_H
+#define SDYN_PROFILE_H 1
+
+#include <stdio.h>
+
+#include "parser.h"
+
+/* nonzero if allocations are being profiled */
+extern int sdyn_allocProfiling;
+
+/* the current allocation site. While profiling, JIT code sets this before
+ * every call it makes, and sdyn_call puts it back when the callee returns, so
+ * it's 0 (C code) whenever no JIT code is running. */
+extern size_t sdyn_allocSite;
+
+/* start profiling if SDYN_ALLOC_PROFILE names a file to report to */
+void sdyn_initAllocProfile(void);
+
+/* name the function whose sites are about to be made */
+void sdyn_allocProfileFunction(SDyn_Node func);
+
+/* make an allocation site for IR node idx, with operation op, in the current
+ * function */
+size_t sdyn_allocProfileSite(size_t idx, int op);
+
+/* write out the profile so far */
+void sdyn_allocProfileReport(FILE *out);
+
+#endif
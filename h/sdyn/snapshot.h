@@ -0,0 +1,40 @@
+/*
+ * SDyn: Heap snapshots
+ *
+ * Copyright (c) 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDYN_SNAPSHOT_H
+#define SDYN_SNAPSHOT_H 1
+
+#include <signal.h>
+#include <stdio.h>
+
+/* set by SIGUSR2, to ask for a snapshot at the next call */
+extern volatile sig_atomic_t sdyn_heapSnapshotRequested;
+
+/* take snapshots on SIGUSR2 */
+void sdyn_initHeapSnapshot(void);
+
+/* write a snapshot of the heap, as JSON. This collects fully first, so it
+ * must be called at a point where the caller's pointers are all rooted. */
+void sdyn_heapSnapshot(FILE *out);
+
+/* write a snapshot to a file, named after the process if path is NULL.
+ * Returns the name it used (in a static buffer if it made it up), or NULL if
+ * the file couldn't be written. */
+const char *sdyn_heapSnapshotFile(const char *path);
+
+#endif
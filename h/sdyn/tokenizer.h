@@ -23,11 +23,13 @@
 
 struct SDyn_Token {
     enum SDyn_TokenType type;
+    unsigned int line, col; /* both from 1 */
     size_t valLen;
     const unsigned char *val;
 };
 
-/* get a single token */
-struct SDyn_Token sdyn_tokenize(const unsigned char *inp);
+/* tokenize all of the input in one pass. Returns an array of tokens ending
+ * with an EOF token, to be freed with free() */
+struct SDyn_Token *sdyn_tokenize(const unsigned char *inp);
 
 #endif
@@ -49,10 +49,14 @@ enum SDyn_DataType {
     SDYN_TYPE_LAST
 };
 
-/* the type tag for boxed data types */
-GGC_TYPE(SDyn_Tag)
-    GGC_MDATA(int, type);
-GGC_END_TYPE(SDyn_Tag, GGC_NO_PTRS);
+/* name a type, as typeof would. Anything that isn't a boxed SDyn type is
+ * "untagged", such as GGGGC's and SDyn's own structures (shapes, maps, member
+ * arrays and so on) */
+const char *sdyn_typeName(int type);
+
+/* the type of a boxed value. Every boxed type's descriptors carry it in their
+ * user data word, so it's a load of the descriptor and then of the type */
+#define SDYN_BOXED_TYPE(value) ((int) GGC_RUD(value))
 
 /* boxed undefined, also used as a supertype of sorts */
 GGC_TYPE(SDyn_Undefined)
@@ -68,11 +72,20 @@ GGC_TYPE(SDyn_Number)
     GGC_MDATA(long, value);
 GGC_END_TYPE(SDyn_Number, GGC_NO_PTRS);
 
-/* boxed strings */
+/* boxed strings. A string is either flat, in which case left is NULL and its
+ * characters are stored inline (so GGC_RAD works on it as on a char array), or
+ * a rope (lazy concatenation) of left and right. Once a rope is flattened, left
+ * points to the flat string and right is NULL. Because the size of a flat
+ * string depends on its length, strings are allocated with sdyn_newString, not
+ * GGC_NEW. */
 GGC_TYPE(SDyn_String)
-    GGC_MPTR(GGC_char_Array, value);
+    GGC_MDATA(size_t, length);
+    GGC_MPTR(SDyn_String, left);
+    GGC_MPTR(SDyn_String, right);
+    char a__data[1];
 GGC_END_TYPE(SDyn_String,
-    GGC_PTR(SDyn_String, value)
+    GGC_PTR(SDyn_String, left)
+    GGC_PTR(SDyn_String, right)
     );
 
 /* object shape */
@@ -124,6 +137,11 @@ extern SDyn_Boolean sdyn_false, sdyn_true;
 extern SDyn_Shape sdyn_emptyShape;
 extern SDyn_Object sdyn_globalObject;
 
+/* preallocated boxes for the integers 0 through SDYN_SMALL_INTS-1, which
+ * sdyn_boxInt (and the JIT) return rather than allocating */
+#define SDYN_SMALL_INTS 1024
+extern SDyn_NumberArray sdyn_smallInts;
+
 /* our global value initializer */
 void sdyn_initValues(void);
 
@@ -141,12 +159,21 @@ SDyn_Boolean sdyn_boxBool(void **pstack, int value);
 /* simple boxer for ints */
 SDyn_Number sdyn_boxInt(void **pstack, long value);
 
+/* allocate a flat string with room for len characters */
+SDyn_String sdyn_newString(size_t len);
+
 /* simple boxer for strings */
 SDyn_String sdyn_boxString(void **pstack, char *value, size_t len);
 
 /* and a specialized boxer for quoted strings */
 SDyn_String sdyn_unquote(SDyn_String istr);
 
+/* concatenate two strings, lazily if they're long enough to warrant it */
+SDyn_String sdyn_concat(void **pstack, SDyn_String left, SDyn_String right);
+
+/* get a flat version of a string, flattening it if it's a rope */
+SDyn_String sdyn_flattenString(SDyn_String str);
+
 /* type coercions */
 int sdyn_toBoolean(void **pstack, SDyn_Undefined value);
 long sdyn_toNumber(void **pstack, SDyn_Undefined value);
@@ -166,6 +193,10 @@ size_t sdyn_getObjectMemberIndex(void **pstack, SDyn_Object object, SDyn_String
 /* get a member of an object, or sdyn_undefined if it does not exist */
 SDyn_Undefined sdyn_getObjectMember(void **pstack, SDyn_Object object, SDyn_String member);
 
+/* the same, without allocating or pushing. The name must be flat (not a
+ * rope, even a flattened one) */
+SDyn_Undefined sdyn_getObjectMemberLeaf(void **pstack, SDyn_Object object, SDyn_String member);
+
 /* set or add a member on/to an object */
 void sdyn_setObjectMember(void **pstack, SDyn_Object object, SDyn_String member, SDyn_Undefined value);
 
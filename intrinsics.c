@@ -23,25 +23,28 @@
 
 #include "sdyn/exec.h"
 #include "sdyn/intrinsics.h"
+#include "sdyn/snapshot.h"
 
 /* get an intrinsic by name. All intrinsics are simply hardwired */
 sdyn_native_function_t sdyn_getIntrinsic(SDyn_String intrinsic)
 {
-    GGC_char_Array schar = NULL;
+    GGC_PUSH_1(intrinsic);
 
-    GGC_PUSH_2(intrinsic, schar);
+    intrinsic = sdyn_flattenString(intrinsic);
 
-    schar = GGC_RP(intrinsic, value);
-
-#define TOK(str) if (!strncmp(schar->a__data, "$" #str, schar->length))
+#define TOK(str) if (!strncmp(intrinsic->a__data, "$" #str, GGC_RD(intrinsic, length)))
 
     TOK(eval) {
         return sdyn_iEval;
+    } else TOK(gcStats) {
+        return sdyn_iGCStats;
+    } else TOK(heapSnapshot) {
+        return sdyn_iHeapSnapshot;
     } else TOK(print) {
         return sdyn_iPrint;
     }
 
-    fprintf(stderr, "Invalid native function %.*s!\n", (int) schar->length, schar->a__data);
+    fprintf(stderr, "Invalid native function %.*s!\n", (int) GGC_RD(intrinsic, length), intrinsic->a__data);
     abort();
 }
 
@@ -49,29 +52,30 @@ sdyn_native_function_t sdyn_getIntrinsic(SDyn_String intrinsic)
 SDyn_Undefined sdyn_iEval(void **pstack, size_t argCt, SDyn_Undefined *args)
 {
     SDyn_String codeStr = NULL;
-    GGC_char_Array codeA = NULL;
+    size_t len;
     unsigned char *code;
 
     if (pstack) ggc_jitPointerStack = pstack;
 
-    GGC_PUSH_2(codeStr, codeA);
+    GGC_PUSH_1(codeStr);
 
     /* get our code */
     if (argCt >= 1) codeStr = sdyn_toString(NULL, args[0]);
     else codeStr = sdyn_boxString(NULL, "", 0);
 
     /* get it out of the GC */
-    codeA = GGC_RP(codeStr, value);
-    code = malloc(codeA->length + 1);
+    codeStr = sdyn_flattenString(codeStr);
+    len = GGC_RD(codeStr, length);
+    code = malloc(len + 1);
     if (!code) {
         perror("malloc");
         exit(1);
     }
-    memcpy(code, codeA->a__data, codeA->length);
-    code[codeA->length] = 0;
+    memcpy(code, codeStr->a__data, len);
+    code[len] = 0;
 
-    /* and execute */
-    sdyn_exec(code);
+    /* and execute. Code can be eval'd over and over, so it isn't permanent */
+    sdyn_exec(code, 0);
 
     return sdyn_undefined;
 }
@@ -80,17 +84,151 @@ SDyn_Undefined sdyn_iEval(void **pstack, size_t argCt, SDyn_Undefined *args)
 SDyn_Undefined sdyn_iPrint(void **pstack, size_t argCt, SDyn_Undefined *args)
 {
     SDyn_String string = NULL;
-    GGC_char_Array schar = NULL;
 
     if (pstack) ggc_jitPointerStack = pstack;
 
-    GGC_PUSH_2(string, schar);
+    GGC_PUSH_1(string);
 
     if (argCt < 1) return sdyn_undefined;
 
     string = sdyn_toString(NULL, args[0]);
-    schar = GGC_RP(string, value);
-    printf("%.*s\n", (int) schar->length, schar->a__data);
+    string = sdyn_flattenString(string);
+    printf("%.*s\n", (int) GGC_RD(string, length), string->a__data);
 
     return sdyn_undefined;
 }
+
+/* set a number member of an object by name */
+static void setNumberMember(SDyn_Object object, const char *name, long value)
+{
+    SDyn_String nameStr = NULL;
+    SDyn_Number number = NULL;
+
+    GGC_PUSH_3(object, nameStr, number);
+
+    nameStr = sdyn_boxString(NULL, (char *) name, strlen(name));
+    number = sdyn_boxInt(NULL, value);
+    sdyn_setObjectMember(NULL, object, nameStr, (SDyn_Undefined) number);
+}
+
+/* get the collector's statistics as an object, with the last collection as
+ * its "last" member */
+SDyn_Undefined sdyn_iGCStats(void **pstack, size_t argCt, SDyn_Undefined *args)
+{
+    struct GGGGC_Stats stats;
+    SDyn_Object ret = NULL, last = NULL;
+    SDyn_String nameStr = NULL;
+
+    if (pstack) ggc_jitPointerStack = pstack;
+
+    GGC_PUSH_3(ret, last, nameStr);
+
+    /* take them before we allocate anything */
+    ggggc_getStats(&stats);
+
+    ret = sdyn_newObject(NULL);
+    setNumberMember(ret, "collections", stats.collections);
+    setNumberMember(ret, "majorCollections", stats.majorCollections);
+    setNumberMember(ret, "compactions", stats.compactions);
+    setNumberMember(ret, "totalPauseNs", stats.totalPauseNs);
+    setNumberMember(ret, "maxPauseNs", stats.maxPauseNs);
+    setNumberMember(ret, "bytesAllocated", stats.bytesAllocated);
+    setNumberMember(ret, "heapBytes", stats.heapBytes);
+    setNumberMember(ret, "largeBytes", stats.largeBytes);
+    setNumberMember(ret, "liveBytes", stats.liveBytes);
+    setNumberMember(ret, "permanentBytes", stats.permanentBytes);
+
+    last = sdyn_newObject(NULL);
+    setNumberMember(last, "number", stats.last.number);
+    setNumberMember(last, "major", stats.last.major);
+    setNumberMember(last, "pauseNs", stats.last.pauseNs);
+    setNumberMember(last, "sliceNs", stats.last.sliceNs);
+    setNumberMember(last, "roots", stats.last.roots);
+    setNumberMember(last, "bytesMarked", stats.last.bytesMarked);
+    setNumberMember(last, "bytesFreed", stats.last.bytesFreed);
+    setNumberMember(last, "freeListBytes", stats.last.freeListBytes);
+    setNumberMember(last, "freeListBlocks", stats.last.freeListBlocks);
+    setNumberMember(last, "poolsBefore", stats.last.poolsBefore);
+    setNumberMember(last, "poolsAfter", stats.last.poolsAfter);
+    setNumberMember(last, "bytesCompacted", stats.last.bytesCompacted);
+    nameStr = sdyn_boxString(NULL, "last", 4);
+    sdyn_setObjectMember(NULL, ret, nameStr, (SDyn_Undefined) last);
+
+    return (SDyn_Undefined) ret;
+}
+
+/* write a heap snapshot to the file named by the argument, or to one named
+ * after the process, and return the file's name */
+SDyn_Undefined sdyn_iHeapSnapshot(void **pstack, size_t argCt, SDyn_Undefined *args)
+{
+    SDyn_String pathStr = NULL;
+    char *path = NULL;
+    const char *written;
+    size_t len;
+
+    if (pstack) ggc_jitPointerStack = pstack;
+
+    GGC_PUSH_1(pathStr);
+
+    /* get the path out of the GC */
+    if (argCt >= 1 && args[0] != sdyn_undefined) {
+        pathStr = sdyn_toString(NULL, args[0]);
+        pathStr = sdyn_flattenString(pathStr);
+        len = GGC_RD(pathStr, length);
+        path = malloc(len + 1);
+        if (!path) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(path, pathStr->a__data, len);
+        path[len] = 0;
+    }
+
+    written = sdyn_heapSnapshotFile(path);
+    if (written)
+        pathStr = sdyn_boxString(NULL, (char *) written, strlen(written));
+    free(path);
+
+    return written ? (SDyn_Undefined) pathStr : sdyn_undefined;
+}
+
+/* the GC log, if SDYN_GC_LOG is set */
+static FILE *gcLog = NULL;
+
+static const char *gcReasons[] = {
+    "explicit", "allocation", "yield", "large", "incremental", "limit",
+    "snapshot"
+};
+
+/* write a collection to the GC log, as a line of JSON */
+static void logCollection(const struct GGGGC_CollectionStats *stats)
+{
+    fprintf(gcLog, "{\"gc\":%llu,\"reason\":\"%s\",\"major\":%s,"
+        "\"pauseNs\":%llu,\"sliceNs\":%llu,\"roots\":%lu,"
+        "\"bytesMarked\":%lu,\"bytesFreed\":%lu,"
+        "\"freeListBytes\":%lu,\"freeListBlocks\":%lu,"
+        "\"poolsBefore\":%lu,\"poolsAfter\":%lu,\"bytesCompacted\":%lu}\n",
+        stats->number, gcReasons[stats->reason], stats->major ? "true" : "false",
+        stats->pauseNs, stats->sliceNs, (unsigned long) stats->roots,
+        (unsigned long) stats->bytesMarked, (unsigned long) stats->bytesFreed,
+        (unsigned long) stats->freeListBytes, (unsigned long) stats->freeListBlocks,
+        (unsigned long) stats->poolsBefore, (unsigned long) stats->poolsAfter,
+        (unsigned long) stats->bytesCompacted);
+}
+
+/* open the GC log named by SDYN_GC_LOG, if any */
+void sdyn_initGCLog()
+{
+    const char *path = getenv("SDYN_GC_LOG");
+    if (!path || !path[0]) return;
+
+    gcLog = fopen(path, "w");
+    if (!gcLog) {
+        perror(path);
+        return;
+    }
+
+    /* a line at a time, so that it's useful even if we crash */
+    setvbuf(gcLog, NULL, _IOLBF, 0);
+    ggggc_setCollectionHook(logCollection);
+}
@@ -44,6 +44,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "ggggc/gc.h"
@@ -780,6 +781,22 @@ static size_t irCompileNode(SDyn_IRNodeList ir, SDyn_Node node, SDyn_IndexMap sy
     return GGC_RD(ir, length) - 1;
 }
 
+/* find the node a node is ultimately unified with */
+static size_t irUidxRoot(SDyn_IRNodeArray ir, size_t idx)
+{
+    SDyn_IRNode node = NULL;
+
+    GGC_PUSH_2(ir, node);
+
+    node = GGC_RAP(ir, idx);
+    while (GGC_RD(node, uidx) != idx) {
+        idx = GGC_RD(node, uidx);
+        node = GGC_RAP(ir, idx);
+    }
+
+    return idx;
+}
+
 /* set up the uidxs for all nodes */
 static void irUidx(SDyn_IRNodeArray ir)
 {
@@ -800,14 +817,32 @@ static void irUidx(SDyn_IRNodeArray ir)
         node = GGC_RAP(ir, si);
 
         if (GGC_RD(node, op) == SDYN_NODE_UNIFY) {
-            idx = GGC_RD(node, uidx);
+            idx = irUidxRoot(ir, si);
             GGC_WD(node, rtype, SDYN_TYPE_BOXED);
-            unode = GGC_RAP(ir, GGC_RD(node, left));
-            GGC_WD(unode, uidx, idx);
-            unode = GGC_RAP(ir, GGC_RD(node, right));
-            GGC_WD(unode, uidx, idx);
+
+            /* an operand may already be unified with something else (a
+             * variable assigned in an if within a loop is unified both at the
+             * end of the if and at the end of the loop), so join the whole
+             * set rather than moving just the operand out of its old one */
+            uidx = irUidxRoot(ir, GGC_RD(node, left));
+            if (uidx != idx) {
+                unode = GGC_RAP(ir, uidx);
+                GGC_WD(unode, uidx, idx);
+            }
+            uidx = irUidxRoot(ir, GGC_RD(node, right));
+            if (uidx != idx) {
+                unode = GGC_RAP(ir, uidx);
+                GGC_WD(unode, uidx, idx);
+            }
         }
     }
+
+    /* and point every node straight at its set's representative */
+    for (si = 0; si < ir->length; si++) {
+        idx = irUidxRoot(ir, si);
+        node = GGC_RAP(ir, si);
+        GGC_WD(node, uidx, idx);
+    }
 }
 
 /* flow IR types through operations */
@@ -935,18 +970,167 @@ SDyn_IRNodeArray sdyn_irCompilePrime(SDyn_Node func)
     return ret;
 }
 
+/* Narrow each node's record of the pointer stack slots holding values, which
+ * register allocation leaves saying which slots are allocated as it begins, to
+ * the slots stored to on every path to it. Slots are allocated over a linear
+ * range of the IR, so a value assigned in only one branch of an if has its
+ * slot allocated, but nothing stored in it, all through the other branch. A
+ * slot stops holding a value once it's freed. Any value used is stored on every
+ * path to its use (values carried around loops share a slot, by unification),
+ * so nothing in use is left out. */
+static void irStoredSlots(SDyn_IRNodeArray ir, size_t slots)
+{
+    SDyn_IRNode node = NULL;
+    GGC_size_t_Array jumps = NULL;
+    GGC_char_Array stored = NULL, reached = NULL, out = NULL, allocated = NULL,
+        live = NULL;
+    size_t si, i, end, to, succ[2], succCt, addr;
+    int changed, write, tmpi;
+
+    GGC_PUSH_8(ir, node, jumps, stored, reached, out, allocated, live);
+
+    /* find where each jump goes */
+    jumps = GGC_NEW_DA(size_t, ir->length);
+    end = 0;
+    for (si = 0; si < ir->length; si++) {
+        node = GGC_RAP(ir, si);
+        switch (GGC_RD(node, op)) {
+            case SDYN_NODE_IFELSE:
+                /* a false condition jumps past this, to the else clause */
+                to = si + 1;
+                GGC_WAD(jumps, GGC_RD(node, left), to);
+                break;
+
+            case SDYN_NODE_IFEND:
+                /* and the end of the if clause jumps here */
+                GGC_WAD(jumps, GGC_RD(node, left), si);
+                break;
+
+            case SDYN_NODE_WEND:
+                /* a false condition jumps past this, and this jumps back */
+                to = si + 1;
+                GGC_WAD(jumps, GGC_RD(node, right), to);
+                to = GGC_RD(node, left);
+                GGC_WAD(jumps, si, to);
+                break;
+
+            case SDYN_NODE_PPOPA:
+                /* every return jumps here */
+                end = si;
+                break;
+        }
+    }
+
+    /* then flow what's stored forward until nothing changes. stored holds,
+     * for each node reached so far, the slots stored to as it begins */
+    stored = GGC_NEW_DA(char, ir->length * slots);
+    reached = GGC_NEW_DA(char, ir->length);
+    out = GGC_NEW_DA(char, slots);
+    GGC_WAD(reached, 0, 1);
+    do {
+        changed = 0;
+        for (si = 0; si < ir->length; si++) {
+            if (!GGC_RAD(reached, si)) continue;
+            node = GGC_RAP(ir, si);
+
+            /* a node stores its own value, except unifications, which only
+             * name the slot their operands store to */
+            write = GGC_RD(node, stype) == SDYN_STORAGE_PSTK &&
+                    GGC_RD(node, op) != SDYN_NODE_UNIFY;
+            addr = GGC_RD(node, addr);
+
+            /* and anything it frees is no longer allocated after it */
+            allocated = NULL;
+            if (si + 1 < ir->length) {
+                node = GGC_RAP(ir, si + 1);
+                allocated = GGC_RP(node, live);
+                node = GGC_RAP(ir, si);
+            }
+            for (i = 0; i < slots; i++) {
+                tmpi = GGC_RAD(stored, si * slots + i) || (write && i == addr);
+                if (!allocated || i >= allocated->length || !GGC_RAD(allocated, i))
+                    tmpi = 0;
+                GGC_WAD(out, i, tmpi);
+            }
+
+            /* find where it goes */
+            succCt = 0;
+            switch (GGC_RD(node, op)) {
+                case SDYN_NODE_RETURN:
+                    succ[succCt++] = end;
+                    break;
+
+                case SDYN_NODE_IFELSE:
+                case SDYN_NODE_WEND:
+                    succ[succCt++] = GGC_RAD(jumps, si);
+                    break;
+
+                default:
+                    if (GGC_RAD(jumps, si))
+                        succ[succCt++] = GGC_RAD(jumps, si);
+                    if (si + 1 < ir->length)
+                        succ[succCt++] = si + 1;
+            }
+
+            /* and keep only what's stored on every path there */
+            while (succCt) {
+                to = succ[--succCt];
+                if (!GGC_RAD(reached, to)) {
+                    GGC_WAD(reached, to, 1);
+                    for (i = 0; i < slots; i++) {
+                        tmpi = GGC_RAD(out, i);
+                        GGC_WAD(stored, to * slots + i, tmpi);
+                    }
+                    changed = 1;
+                } else {
+                    for (i = 0; i < slots; i++) {
+                        if (GGC_RAD(stored, to * slots + i) && !GGC_RAD(out, i)) {
+                            GGC_WAD(stored, to * slots + i, 0);
+                            changed = 1;
+                        }
+                    }
+                }
+            }
+        }
+    } while (changed);
+
+    /* replace the records, with runs of nodes sharing one copy as before.
+     * Nodes never reached never make a call, so they hold nothing. */
+    live = NULL;
+    for (si = 0; si < ir->length; si++) {
+        if (live && si > 0 && GGC_RAD(reached, si) == GGC_RAD(reached, si - 1) &&
+            memcmp(&GGC_RAD(stored, si * slots), &GGC_RAD(stored, (si - 1) * slots), slots) == 0) {
+            /* same as the last */
+        } else {
+            live = GGC_NEW_DA(char, slots);
+            if (GGC_RAD(reached, si)) {
+                for (i = 0; i < slots; i++) {
+                    tmpi = GGC_RAD(stored, si * slots + i);
+                    GGC_WAD(live, i, tmpi);
+                }
+            }
+        }
+        node = GGC_RAP(ir, si);
+        GGC_WP(node, live, live);
+    }
+
+    return;
+}
+
 /* perform register allocation on an IR */
 void sdyn_irRegAlloc(SDyn_IRNodeArray ir, struct SDyn_RegisterMap *registerMap)
 {
     SDyn_IRNode node = NULL, unode = NULL, callNode = NULL;
     GGC_char_Array stksUsed = NULL, pstksUsed = NULL, irUsed = NULL;
+    GGC_char_Array live = NULL, oldLive = NULL;
     GGC_size_t_Array lastUsed = NULL;
     int last[4];
-    int li, tmpi;
+    int li, tmpi, liveChanged;
     size_t i, idx, stkUsed, pstkUsed, astkUsed;
     long si;
 
-    GGC_PUSH_8(ir, node, unode, callNode, stksUsed, pstksUsed, irUsed, lastUsed);
+    GGC_PUSH_10(ir, node, unode, callNode, stksUsed, pstksUsed, irUsed, live,
+        oldLive, lastUsed);
 
 #define USED(v) do { \
     size_t vv = (v); \
@@ -1025,6 +1209,7 @@ void sdyn_irRegAlloc(SDyn_IRNodeArray ir, struct SDyn_RegisterMap *registerMap)
     stksUsed = GGC_NEW_DA(char, ir->length);
     pstksUsed = GGC_NEW_DA(char, ir->length);
     stkUsed = pstkUsed = astkUsed = 0;
+    liveChanged = 1;
     for (si = 0; si < ir->length; si++) {
         int stype = 0;
         size_t addr = 0;
@@ -1032,6 +1217,20 @@ void sdyn_irRegAlloc(SDyn_IRNodeArray ir, struct SDyn_RegisterMap *registerMap)
         size_t *cstkUsed;
 
         node = GGC_RAP(ir, si);
+
+        /* remember which pointer stack slots are allocated as this begins,
+         * for the JIT's stack maps (see irStoredSlots). Runs of nodes share
+         * one copy. */
+        if (liveChanged) {
+            live = GGC_NEW_DA(char, pstkUsed);
+            for (i = 0; i < pstkUsed; i++) {
+                tmpi = GGC_RAD(pstksUsed, i);
+                GGC_WAD(live, i, tmpi);
+            }
+            liveChanged = 0;
+        }
+        GGC_WP(node, live, live);
+
         idx = GGC_RD(node, uidx);
         unode = GGC_RAP(ir, idx);
         while (GGC_RD(unode, uidx) != idx) {
@@ -1085,10 +1284,12 @@ void sdyn_irRegAlloc(SDyn_IRNodeArray ir, struct SDyn_RegisterMap *registerMap)
         GGC_WD(unode, stype, stype);
         GGC_WD(unode, addr, i);
         if (i >= *cstkUsed) *cstkUsed = i + 1;
-        if (cstksUsed == &pstksUsed)
+        if (cstksUsed == &pstksUsed) {
             GGC_WAD(pstksUsed, i, 1);
-        else
+            liveChanged = 1;
+        } else {
             GGC_WAD(stksUsed, i, 1);
+        }
 
         /* and remove any that are no longer used */
         lastUsed = GGC_RP(node, lastUsed);
@@ -1099,6 +1300,7 @@ void sdyn_irRegAlloc(SDyn_IRNodeArray ir, struct SDyn_RegisterMap *registerMap)
                 addr = GGC_RD(unode, addr);
                 if (stype == SDYN_STORAGE_PSTK) {
                     GGC_WAD(pstksUsed, addr, 0);
+                    liveChanged = 1;
                 } else if (stype == SDYN_STORAGE_STK) {
                     GGC_WAD(stksUsed, addr, 0);
                 }
@@ -1106,12 +1308,30 @@ void sdyn_irRegAlloc(SDyn_IRNodeArray ir, struct SDyn_RegisterMap *registerMap)
         }
     }
 
+    /* only count slots as holding values where they've been stored to */
+    irStoredSlots(ir, pstkUsed);
+
     /* now go through and fix up the stack addresses, allocas and popas to account for the argument stack */
     if (astkUsed < 2) astkUsed = 2; /* always allocate some play space for pointers */
     pstkUsed += astkUsed;
+    oldLive = NULL;
     for (si = 0; si < ir->length; si++) {
         size_t addr = 0;
         node = GGC_RAP(ir, si);
+
+        /* the argument stack always holds values */
+        if (GGC_RP(node, live) != oldLive) {
+            oldLive = GGC_RP(node, live);
+            live = GGC_NEW_DA(char, pstkUsed);
+            for (i = 0; i < astkUsed; i++)
+                GGC_WAD(live, i, 1);
+            for (; i < astkUsed + oldLive->length; i++) {
+                tmpi = GGC_RAD(oldLive, i - astkUsed);
+                GGC_WAD(live, i, tmpi);
+            }
+        }
+        GGC_WP(node, live, live);
+
         if (GGC_RD(node, stype) == SDYN_STORAGE_PSTK) {
             addr = GGC_RD(node, addr) + astkUsed;
             GGC_WD(node, addr, addr);
@@ -1133,7 +1353,39 @@ void sdyn_irRegAlloc(SDyn_IRNodeArray ir, struct SDyn_RegisterMap *registerMap)
     return;
 }
 
-/* compile and perform register allocation */
+/* copy an IR into permanent space, with the names and register allocation
+ * it refers to */
+static SDyn_IRNodeArray irPermanent(SDyn_IRNodeArray ir)
+{
+    SDyn_IRNode node = NULL;
+    void *immp = NULL;
+    GGC_size_t_Array lastUsed = NULL;
+    GGC_char_Array live = NULL, oldLive = NULL;
+    size_t i;
+
+    GGC_PUSH_6(ir, node, immp, lastUsed, live, oldLive);
+
+    ir = (SDyn_IRNodeArray) ggggc_copyPermanent(ir);
+    for (i = 0; i < ir->length; i++) {
+        node = (SDyn_IRNode) ggggc_copyPermanent(GGC_RAP(ir, i));
+        GGC_WAP(ir, i, node);
+        immp = ggggc_copyPermanent(GGC_RP(node, immp));
+        GGC_WP(node, immp, immp);
+        lastUsed = (GGC_size_t_Array) ggggc_copyPermanent(GGC_RP(node, lastUsed));
+        GGC_WP(node, lastUsed, lastUsed);
+        if (GGC_RP(node, live) != oldLive) {
+            /* keep runs of nodes sharing their live slots */
+            oldLive = GGC_RP(node, live);
+            live = (GGC_char_Array) ggggc_copyPermanent(oldLive);
+        }
+        GGC_WP(node, live, live);
+    }
+
+    return ir;
+}
+
+/* compile and perform register allocation. A permanent function's IR is
+ * permanent too. */
 SDyn_IRNodeArray sdyn_irCompile(SDyn_Node func, struct SDyn_RegisterMap *registerMap)
 {
     SDyn_IRNodeArray ret = NULL;
@@ -1142,6 +1394,8 @@ SDyn_IRNodeArray sdyn_irCompile(SDyn_Node func, struct SDyn_RegisterMap *registe
 
     ret = sdyn_irCompilePrime(func);
     sdyn_irRegAlloc(ret, registerMap);
+    if (ggggc_isPermanent(func))
+        ret = irPermanent(ret);
 
     return ret;
 }
@@ -1153,19 +1407,13 @@ static void dumpIR(SDyn_IRNodeArray ir)
 {
     SDyn_IRNode node = NULL;
     SDyn_String string = NULL;
-    SDyn_Tag tag = NULL;
-    GGC_char_Array arr = NULL, yes = NULL, na = NULL;
+    SDyn_String arr = NULL, yes = NULL, na = NULL;
     size_t i;
-    char c;
 
-    GGC_PUSH_7(ir, node, string, tag, arr, yes, na);
+    GGC_PUSH_6(ir, node, string, arr, yes, na);
 
-    yes = GGC_NEW_DA(char, 1);
-    c = '+';
-    GGC_WAD(yes, 0, c);
-    na = GGC_NEW_DA(char, 1);
-    c = '-';
-    GGC_WAD(na, 0, c);
+    yes = sdyn_boxString(NULL, "+", 1);
+    na = sdyn_boxString(NULL, "-", 1);
 
     for (i = 0; i < ir->length; i++) {
         node = GGC_RAP(ir, i);
@@ -1175,9 +1423,8 @@ static void dumpIR(SDyn_IRNodeArray ir)
         arr = na;
         if (string) {
             arr = yes;
-            tag = (SDyn_Tag) GGC_RUP(string);
-            if (tag && GGC_RD(tag, type) == SDYN_TYPE_STRING)
-                arr = GGC_RP(string, value);
+            if (SDYN_BOXED_TYPE(string) == SDYN_TYPE_STRING)
+                arr = sdyn_flattenString(string);
         }
 
         /* and print it */
@@ -1186,7 +1433,7 @@ static void dumpIR(SDyn_IRNodeArray ir)
                 sdyn_nodeNames[GGC_RD(node, op)],
                 GGC_RD(node, rtype),
                 GGC_RD(node, stype), (unsigned long) GGC_RD(node, addr),
-                (unsigned long) GGC_RD(node, imm), (int) arr->length, arr->a__data,
+                (unsigned long) GGC_RD(node, imm), (int) GGC_RD(arr, length), arr->a__data,
                 (unsigned long) GGC_RD(node, left), (unsigned long) GGC_RD(node, right));
     }
 
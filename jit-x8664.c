@@ -21,7 +21,8 @@
  *
  *  By the Unix calling convention, the first four arguments go in RDI, RSI,
  *  RDX, RCX, the return goes in RAX, RSP is the stack pointer and RBP is the
- *  frame pointer. We use ONLY these registers. RSP must be 16-byte aligned.
+ *  frame pointer. We use ONLY these registers, except that R11 is used as a
+ *  scratch register before calls. RSP must be 16-byte aligned.
  *
  *  RDI is used as the second (collected pointer) stack. RDI will never be
  *  overwritten by a JIT function, but MAY be overwritten by a normal function,
@@ -38,15 +39,19 @@
  *  restore RDI to its former value before returning to the caller.
  *
  *  When a JIT function initializes, its conventional stack space is not
- *  initialized (i.e., it's garbage), but its pointer stack space must be, and
- *  is initialized to many pointers to sdyn_undefined.
+ *  initialized (i.e., it's garbage), and neither is most of its pointer stack
+ *  space. Before every call, 0(RDI) is set to the stack map for that call (see
+ *  GGGGC_JITStackMap), built from the register allocator's record of which
+ *  slots hold values at that point, and the GC scans only those slots. The
+ *  temporaries and argument slots are always scanned, so they're initialized
+ *  to sdyn_undefined.
  *
- *  0(RDI) and 8(RDI) are reserved for temporary collected pointer use.
+ *  8(RDI) and 16(RDI) are reserved for temporary collected pointer use.
  *  -16(RBP) and -8(RBP) are reserved for temporary non-collected or
  *  non-pointer use. -8(RBP) is generally used to store RDI during calls to
  *  non-JIT functions, and should be avoided in other cases so there is no
- *  accidental overlap. Arguments begin at 16(RDI), and storage begins at
- *  16+x(RDI), where x is the maximum number of arguments times the word size
+ *  accidental overlap. Arguments begin at 24(RDI), and storage begins at
+ *  24+x(RDI), where x is the maximum number of arguments times the word size
  *  (8).
  */
 
@@ -58,6 +63,7 @@
 
 #include "sdyn/intrinsics.h"
 #include "sdyn/nodes.h"
+#include "sdyn/profile.h"
 #include "sdyn/value.h"
 
 BUFFER(size_t, size_t);
@@ -78,16 +84,41 @@ static void **createPointer()
     return ret;
 }
 
+/* build the stack map for calls made while the given pointer stack slots hold
+ * values. The frame is the map word, the two temporaries, then the slots. */
+static struct GGGGC_JITStackMap *createStackMap(GGC_char_Array live, size_t frameSize)
+{
+    struct GGGGC_JITStackMap *ret;
+    size_t i;
+
+    ret = calloc(1, GGGGC_JIT_STACK_MAP_BYTES(frameSize));
+    if (ret == NULL) {
+        perror("calloc");
+        abort();
+    }
+
+    ret->size = frameSize;
+    for (i = 1; i < frameSize; i++) {
+        if (i < 3 || GGC_RAD(live, i - 3))
+            ret->live[i / GGGGC_BITS_PER_WORD] |= (ggc_size_t) 1 << (i % GGGGC_BITS_PER_WORD);
+    }
+
+    return ret;
+}
+
 /* compile IR into a native function */
 sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 {
     SDyn_IRNode node = NULL, unode = NULL, onode = NULL;
+    GGC_char_Array mapLive = NULL;
+    struct GGGGC_JITStackMap *stackMap = NULL;
+    size_t frameSize = 0;
     sdyn_native_function_t ret = NULL;
     struct Buffer_uchar buf;
     struct Buffer_size_t returns;
     struct SJA_X8664_Operand left, right, third, target;
     int leftType, rightType, thirdType, targetType;
-    size_t i, uidx, lastArg, unsuppCount;
+    size_t i, uidx, lastArg, unsuppCount, allocSite;
     long imm;
 
     INIT_BUFFER(buf);
@@ -121,7 +152,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 #define IMM64P(o1, v) IMM64(o1, (size_t) (void *) (v))
 #define L(frel)             sja_patchFrel(&buf, (frel))
 
-    GGC_PUSH_4(ir, node, unode, onode);
+    GGC_PUSH_5(ir, node, unode, onode, mapLive);
 
     /* for debugging sake, don't fail on unsupported operations until the end */
     unsuppCount = 0;
@@ -130,6 +161,14 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
     for (i = 0; i < ir->length; i++) {
         node = GGC_RAP(ir, i);
         unode = node;
+        allocSite = 0;
+
+        /* calls from nodes the register allocator saw the same slots live
+         * for share a stack map */
+        if (GGC_RP(node, live) != mapLive) {
+            mapLive = GGC_RP(node, live);
+            stackMap = NULL;
+        }
 
         /* find our desired targetType by looking for the unified IR node. Our
          * own rtype SHOULD be identical, but the unified target is the
@@ -153,7 +192,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
         opa ## Type = GGC_RD(onode, rtype); \
         if (GGC_RD(onode, stype) == SDYN_STORAGE_PSTK) { \
             opa = defreg; \
-            C2(MOV, defreg, MEM(8, RDI, 0, RNONE, GGC_RD(onode, addr) * 8 + 16)); \
+            C2(MOV, defreg, MEM(8, RDI, 0, RNONE, GGC_RD(onode, addr) * 8 + 24)); \
         } else if (GGC_RD(onode, stype) == SDYN_STORAGE_STK) { \
             opa = defreg; \
             C2(MOV, defreg, MEM(8, RSP, 0, RNONE, GGC_RD(onode, addr) * 8)); \
@@ -161,13 +200,48 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
     } \
 } while(0)
 
-        /* macro to perform a call, saving our pointer stack (see architecture notes at the beginning of this file */
+        /* macro to perform a call, saving our pointer stack and describing
+         * it with a stack map (see architecture notes at the beginning of
+         * this file) */
 #define JCALL(what) do { \
+    if (!stackMap) stackMap = createStackMap(mapLive, frameSize); \
+    IMM64P(R11, stackMap); \
+    C2(MOV, MEM(8, RDI, 0, RNONE, 0), R11); \
+    if (sdyn_allocProfiling) { \
+        /* tell the allocation profiler where this call came from */ \
+        if (!allocSite) allocSite = sdyn_allocProfileSite(i, GGC_RD(node, op)); \
+        IMM64P(R11, &sdyn_allocSite); \
+        C2(MOV, MEM(8, R11, 0, RNONE, 0), IMM(allocSite)); \
+    } \
+    C2(MOV, MEM(8, RBP, 0, RNONE, -8), RDI); \
+    C1(CALL, what); \
+    C2(MOV, RDI, MEM(8, RBP, 0, RNONE, -8)); \
+} while(0)
+
+        /* macro to call a leaf runtime function, which never allocates, so
+         * needs no stack map or allocation site */
+#define LCALL(what) do { \
     C2(MOV, MEM(8, RBP, 0, RNONE, -8), RDI); \
     C1(CALL, what); \
     C2(MOV, RDI, MEM(8, RBP, 0, RNONE, -8)); \
 } while(0)
 
+        /* macro to box the int in RSI into RAX, taking small ints from the
+         * preallocated table without a call */
+#define BOXINT() do { \
+    size_t boxSlow, boxDone; \
+    C2(CMP, RSI, IMM(SDYN_SMALL_INTS)); \
+    CF(JAEF, boxSlow); \
+    IMM64P(RAX, &sdyn_smallInts); \
+    C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 0)); \
+    C2(MOV, RAX, MEM(8, RAX, 8, RSI, (size_t) (void *) &((SDyn_NumberArray) 0)->a__ptrs[0])); \
+    CF(JMPF, boxDone); \
+    L(boxSlow); \
+    IMM64P(RAX, sdyn_boxInt); \
+    JCALL(RAX); \
+    L(boxDone); \
+} while(0)
+
         /* macro to box a value of any type */
 #define BOX(type, targ, reg) do { \
     switch (type) { \
@@ -185,8 +259,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
             \
         case SDYN_TYPE_INT: \
             C2(MOV, RSI, reg); \
-            IMM64P(RAX, sdyn_boxInt); \
-            JCALL(RAX); \
+            BOXINT(); \
             C2(MOV, targ, RAX); \
             break; \
             \
@@ -203,7 +276,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
             case SDYN_STORAGE_ASTK:
             case SDYN_STORAGE_PSTK:
-                target = MEM(8, RDI, 0, RNONE, GGC_RD(node, addr)*8 + 16);
+                target = MEM(8, RDI, 0, RNONE, GGC_RD(node, addr)*8 + 24);
                 break;
 
             default:
@@ -228,15 +301,32 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
             {
                 size_t j;
 
-                imm = GGC_RD(node, imm) * 8 + 16; /* two extra words for temporaries */
+                imm = GGC_RD(node, imm) * 8 + 24; /* three extra words for the stack map and temporaries */
+                frameSize = imm / 8;
 
-                /* explicitly assign sdyn_undefined to all new slots, so all
-                 * pointers are valid */
+                /* the stack maps say which slots hold values, so only the
+                 * slots scanned before anything is stored in them (the
+                 * temporaries and the argument slots) need to be valid
+                 * pointers */
                 C2(SUB, RDI, IMM(imm));
                 IMM64P(RAX, &sdyn_undefined);
                 C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 0));
-                for (j = 0; j < imm; j += 8)
-                    C2(MOV, MEM(8, RDI, 0, RNONE, j), RAX);
+                C2(MOV, MEM(8, RDI, 0, RNONE, 8), RAX);
+                C2(MOV, MEM(8, RDI, 0, RNONE, 16), RAX);
+                for (j = 0; j < mapLive->length; j++) {
+                    if (GGC_RAD(mapLive, j))
+                        C2(MOV, MEM(8, RDI, 0, RNONE, j*8 + 24), RAX);
+                }
+
+#ifdef GGGGC_DEBUG_JIT_STACK
+                /* and the rest are poisoned, so that the GC catches a map
+                 * listing one of them before anything is stored to it */
+                IMM64P(RAX, GGGGC_JIT_STACK_POISON);
+                for (j = 0; j < mapLive->length; j++) {
+                    if (!GGC_RAD(mapLive, j))
+                        C2(MOV, MEM(8, RDI, 0, RNONE, j*8 + 24), RAX);
+                }
+#endif
 
                 break;
             }
@@ -258,7 +348,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                  * up all the forward references */
                 for (j = 0; j < returns.bufused; j++)
                     sja_patchFrel(&buf, returns.buf[j]);
-                imm = GGC_RD(node, imm) * 8 + 16;
+                imm = GGC_RD(node, imm) * 8 + 24;
                 C2(ADD, RDI, IMM(imm));
                 break;
             }
@@ -277,7 +367,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 if (leftType != SDYN_TYPE_BOOL) {
                     BOX(leftType, RSI, RAX);
                     IMM64P(RAX, sdyn_toBoolean);
-                    JCALL(RAX);
+                    LCALL(RAX);
                 }
 
                 C2(CMP, RAX, IMM(0));
@@ -340,7 +430,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                     /* boolify it */
                     C2(MOV, RSI, RAX);
                     IMM64P(RAX, sdyn_toBoolean);
-                    JCALL(RAX);
+                    LCALL(RAX);
                 }
 
                 /* now it's ready to check */
@@ -376,19 +466,21 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
             case SDYN_NODE_PARAM:
             {
-                size_t nonExist;
+                size_t nonExist, paramDone;
 
                 /* it is not necessary to provide exactly the right number of
                  * arguments. The number of arguments provided is in RSI. So,
                  * we check whether enough arguments were provided, and if so,
-                 * load in an argument value. Because PALLOCA defaults
-                 * everything to undefined, we don't have to do anything if
-                 * insufficient arguments were provided. */
+                 * load in an argument value, or otherwise undefined. */
                 C2(CMP, RSI, IMM(GGC_RD(node, imm)));
                 CF(JLEF, nonExist); /* argument not provided */
                 C2(MOV, RAX, MEM(8, RDX, 0, RNONE, GGC_RD(node, imm)*8)); /* get it from RDX */
-                C2(MOV, target, RAX);
+                CF(JMPF, paramDone);
                 L(nonExist);
+                IMM64P(RAX, &sdyn_undefined);
+                C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 0));
+                L(paramDone);
+                C2(MOV, target, RAX);
 
                 break;
             }
@@ -396,7 +488,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
             case SDYN_NODE_INTRINSICCALL:
                 /* just get the address of the intrinsic and call it */
                 C2(MOV, RSI, IMM(lastArg + 1));
-                C2(LEA, RDX, MEM(8, RDI, 0, RNONE, 16));
+                C2(LEA, RDX, MEM(8, RDI, 0, RNONE, 24));
                 IMM64P(RAX, sdyn_getIntrinsic((SDyn_String) GGC_RP(node, immp)));
                 JCALL(RAX);
                 C2(MOV, target, RAX);
@@ -408,20 +500,20 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 BOX(leftType, RSI, left);
 
                 /* save the hopefully-function in GC'd space */
-                C2(MOV, MEM(8, RDI, 0, RNONE, 0), RSI);
+                C2(MOV, MEM(8, RDI, 0, RNONE, 8), RSI);
 
                 /* assert that it's a function */
                 IMM64P(RAX, sdyn_assertFunction);
-                JCALL(RAX);
+                LCALL(RAX);
 
                 /* reload it from GC'd space (in case it's moved) */
-                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 0));
+                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 8));
 
                 /* pass in the number of arguments */
                 C2(MOV, RDX, IMM(lastArg + 1));
 
-                /* ARG loads to RDI+16, so just provide that address as the base for arguments */
-                C2(LEA, RCX, MEM(8, RDI, 0, RNONE, 16));
+                /* ARG loads to RDI+24, so just provide that address as the base for arguments */
+                C2(LEA, RCX, MEM(8, RDI, 0, RNONE, 24));
 
                 /* then call sdyn_call */
                 IMM64P(RAX, sdyn_call);
@@ -457,9 +549,16 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 IMM64P(RDX, gstring);
                 C2(MOV, RDX, MEM(8, RDX, 0, RNONE, 0));
 
-                /* get everything into place and call */
-                IMM64P(RAX, sdyn_getObjectMember);
-                JCALL(RAX);
+                /* get everything into place and call. Constant names are
+                 * flat, so the lookup can't allocate, but a rope would need
+                 * flattening */
+                if (!GGC_RP(*gstring, left)) {
+                    IMM64P(RAX, sdyn_getObjectMemberLeaf);
+                    LCALL(RAX);
+                } else {
+                    IMM64P(RAX, sdyn_getObjectMember);
+                    JCALL(RAX);
+                }
 
                 C2(MOV, target, RAX);
                 break;
@@ -479,11 +578,11 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                     C2(MOV, RSI, RAX);
                 }
 
-                C2(MOV, MEM(8, RDI, 0, RNONE, 0), RSI);
+                C2(MOV, MEM(8, RDI, 0, RNONE, 8), RSI);
 
                 LOADOP(right, RAX);
                 BOX(rightType, RCX, right);
-                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 0));
+                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 8));
 
                 /* make the string globally accessible */
                 gstring = (SDyn_String *) createPointer();
@@ -506,7 +605,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 BOX(leftType, RSI, left);
 
                 /* save it in GC'd space */
-                C2(MOV, MEM(8, RDI, 0, RNONE, 0), RSI);
+                C2(MOV, MEM(8, RDI, 0, RNONE, 8), RSI);
 
                 /* right is the "index", which will be coerced to a string */
                 LOADOP(right, RAX);
@@ -516,7 +615,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 C2(MOV, RDX, RAX);
 
                 /* reload the object */
-                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 0));
+                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 8));
 
                 /* then simply sdyn_getObjectMember to access */
                 IMM64P(RAX, sdyn_getObjectMember);
@@ -529,19 +628,19 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 /* (similar to above, but with a value) */
                 LOADOP(left, RAX);
                 BOX(leftType, RSI, left);
-                C2(MOV, MEM(8, RDI, 0, RNONE, 0), RSI);
+                C2(MOV, MEM(8, RDI, 0, RNONE, 8), RSI);
 
                 LOADOP(right, RAX);
                 BOX(rightType, RSI, right);
                 IMM64P(RAX, sdyn_toString);
                 JCALL(RAX);
-                C2(MOV, MEM(8, RDI, 0, RNONE, 8), RAX);
+                C2(MOV, MEM(8, RDI, 0, RNONE, 16), RAX);
 
                 LOADOP(third, RCX);
                 BOX(thirdType, RCX, third);
 
-                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 0));
-                C2(MOV, RDX, MEM(8, RDI, 0, RNONE, 8));
+                C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 8));
+                C2(MOV, RDX, MEM(8, RDI, 0, RNONE, 16));
 
                 IMM64P(RAX, sdyn_setObjectMember);
                 JCALL(RAX);
@@ -585,8 +684,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
                     } else if ((leftType == SDYN_TYPE_INT) && (targetType == SDYN_TYPE_BOXED_INT)) {
                         /* box the int */
-                        IMM64P(RAX, sdyn_boxInt);
-                        JCALL(RAX);
+                        BOXINT();
                         C2(MOV, target, RAX);
 
                     } else {
@@ -600,26 +698,22 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                     break;
                 }
 
-                /* our input is something boxed; check its type. The type tag is buried like so:
+                /* our input is something boxed; check its type. The type is
+                 * kept in the descriptor (see SDYN_BOXED_TYPE):
                  * struct Value {
                  *     struct Descriptor *d;
                  *     ...
                  * };
                  * struct Descriptor {
                  *     struct Descriptor *descriptorDescriptor;
-                 *     struct Tag *tag;
+                 *     void *userPointer;
+                 *     size_t type;
                  *     ...
                  * };
-                 * struct Tag {
-                 *     struct Descriptor *tagDescriptor;
-                 *     long tag;
-                 * };
                  */
                 C2(MOV, RAX, MEM(8, RSI, 0, RNONE, 0)); /* get the descriptor */
-                C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 8)); /* get the tag box */
-                C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 8)); /* get the tag */
 
-                /* now we check if the tag is what we expect */
+                /* now we check if the type is what we expect */
                 {
                     size_t expected = 0;
                     switch (targetType) {
@@ -638,7 +732,8 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                         default:
                             expected = targetType;
                     }
-                    C2(CMP, RAX, IMM(expected));
+                    C2(CMP, MEM(8, RAX, 0, RNONE, (size_t) (void *) &((struct GGGGC_Descriptor *) 0)->user__data),
+                        IMM(expected));
                 }
 
                 /* if it's not, jump to the failed speculation */
@@ -669,8 +764,8 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 break;
 
             case SDYN_NODE_NIL:
-                IMM64P(target, &sdyn_undefined);
-                C2(MOV, RAX, MEM(8, target, 0, RNONE, 0));
+                IMM64P(RAX, &sdyn_undefined);
+                C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 0));
                 C2(MOV, target, RAX);
                 break;
 
@@ -678,8 +773,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 C2(MOV, target, IMM(GGC_RD(node, imm)));
                 if (targetType >= SDYN_TYPE_FIRST_BOXED) {
                     C2(MOV, RSI, target);
-                    IMM64P(RAX, &sdyn_boxInt);
-                    JCALL(RAX);
+                    BOXINT();
                     C2(MOV, target, RAX);
                 }
                 break;
@@ -760,7 +854,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 /* do we need to coerce? */
                 if (leftType != SDYN_TYPE_BOOL) {
                     IMM64P(RAX, sdyn_toBoolean);
-                    JCALL(RAX);
+                    LCALL(RAX);
                     C2(MOV, RSI, RAX);
                 }
 
@@ -783,7 +877,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
                 /* just count on sdyn_typeof */
                 IMM64P(RAX, sdyn_typeof);
-                JCALL(RAX);
+                LCALL(RAX);
                 C2(MOV, target, RAX);
                 break;
 
@@ -838,10 +932,10 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 } else {
                     /* types aren't the same, so just box and go */
                     BOX(leftType, RSI, RSI);
-                    C2(MOV, MEM(8, RDI, 0, RNONE, 0), RSI);
+                    C2(MOV, MEM(8, RDI, 0, RNONE, 8), RSI);
                     LOADOP(right, RDX);
                     BOX(rightType, RDX, RDX);
-                    C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 0));
+                    C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 8));
                     IMM64P(RAX, sdyn_equal);
                     JCALL(RAX);
 
@@ -978,14 +1072,14 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                             C2(MOV, RSI, left);
                             IMM64P(RAX, sdyn_boxBool);
                             JCALL(RAX);
-                            C2(MOV, MEM(8, RDI, 0, RNONE, 0), RAX); /* remember boxed left */
+                            C2(MOV, MEM(8, RDI, 0, RNONE, 8), RAX); /* remember boxed left */
                             C2(MOV, RSI, right);
                             IMM64P(RAX, sdyn_boxBool);
                             JCALL(RAX);
 
                             /* put them in the argument slots */
                             C2(MOV, RDX, RAX);
-                            C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 0));
+                            C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 8));
 
                             /* and add */
                             IMM64P(RAX, sdyn_add);
@@ -997,8 +1091,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                                 /* may as well box now */
                                 C2(MOV, RSI, left);
                                 C2(ADD, RSI, right);
-                                IMM64P(RAX, sdyn_boxInt);
-                                JCALL(RAX);
+                                BOXINT();
 
                             } else {
                                 /* just add! */
@@ -1021,8 +1114,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
                             /* rebox the result if asked */
                             if (targetType >= SDYN_TYPE_FIRST_BOXED) {
-                                IMM64P(RAX, sdyn_boxInt);
-                                JCALL(RAX);
+                                BOXINT();
                             }
                             break;
                         }
@@ -1040,7 +1132,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 } else {
                     /* operands are of different types */
                     struct SJA_X8664_Operand boxedLeft;
-                    boxedLeft = MEM(8, RDI, 0, RNONE, 0);
+                    boxedLeft = MEM(8, RDI, 0, RNONE, 8);
 
                     /* both sides aren't even the same type, so just box 'em and go */
                     if (leftType >= SDYN_TYPE_FIRST_BOXED) {
@@ -1142,8 +1234,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 /* and return */
                 if (targetType >= SDYN_TYPE_FIRST_BOXED) {
                     C2(MOV, RSI, result);
-                    IMM64P(RAX, sdyn_boxInt);
-                    JCALL(RAX);
+                    BOXINT();
                     C2(MOV, target, RAX);
                 } else {
                     C2(MOV, target, result);
@@ -84,6 +84,7 @@ int main()
     OUTSYM(sdyn_assertFunction);
     OUTSYM(sdyn_getObjectMemberIndex);
     OUTSYM(sdyn_getObjectMember);
+    OUTSYM(sdyn_getObjectMemberLeaf);
     OUTSYM(sdyn_setObjectMember);
     OUTSYM(sdyn_add);
     OUTSYM(sdyn_call);
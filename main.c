@@ -25,7 +25,22 @@
 #include "sja/buffer.h"
 
 #include "sdyn/exec.h"
+#include "sdyn/intrinsics.h"
 #include "sdyn/jit.h"
+#include "sdyn/profile.h"
+#include "sdyn/snapshot.h"
+
+/* choose the collector named by SDYN_GC. It must be chosen before anything is
+ * allocated, and types' descriptors are allocated by constructors, so this
+ * runs before them. */
+static void __attribute__((constructor(101))) chooseCollector()
+{
+    const char *collector = getenv("SDYN_GC");
+    if (collector && collector[0] && ggggc_setCollector(collector) < 0) {
+        fprintf(stderr, "sdyn: unknown collector %s\n", collector);
+        exit(1);
+    }
+}
 
 int main(int argc, char **argv)
 {
@@ -36,6 +51,9 @@ int main(int argc, char **argv)
     int hadFile = 0;
     ARG_VARS;
 
+    sdyn_initGCLog();
+    sdyn_initAllocProfile();
+    sdyn_initHeapSnapshot();
     sdyn_initValues();
 
     ARG_NEXT();
@@ -55,7 +73,7 @@ int main(int argc, char **argv)
             WRITE_ONE_BUFFER(buf, 0);
             cur = (const unsigned char *) buf.buf;
 
-            sdyn_exec(cur);
+            sdyn_exec(cur, 1);
 
         } else {
             fprintf(stderr, "Use: sdyn <SDyn files>\n");
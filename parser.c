@@ -35,11 +35,12 @@ char *sdyn_nodeNames[] = {
     "LAST"
 };
 
-#define PEEK() (tok = *ntok)
+/* ntok points to our place in the token array, which ends with EOF */
+#define PEEK() (tok = **ntok)
 
 #define NEXT() do { \
     PEEK(); \
-    *ntok = sdyn_tokenize(ntok->val + ntok->valLen); \
+    if (tok.type != SDYN_TOKEN_EOF) (*ntok)++; \
 } while(0)
 
 #define IFTOK(ttype) if (tok.type == SDYN_TOKEN_ ## ttype)
@@ -47,7 +48,8 @@ char *sdyn_nodeNames[] = {
 #define IFNOTTOK(ttype) if (tok.type != SDYN_TOKEN_ ## ttype)
 
 #define ERROR() do { \
-    fprintf(stderr, "Unrecoverable error at token %.*s\n", (int) tok.valLen, (char *) tok.val); \
+    fprintf(stderr, "Unrecoverable error at %u:%u, token %.*s\n", tok.line, tok.col, \
+        (int) tok.valLen, (char *) tok.val); \
     abort(); \
 } while(0)
 
@@ -69,7 +71,7 @@ char *sdyn_nodeNames[] = {
 
 GGC_LIST(SDyn_Node)
 
-#define PARSER(name) static SDyn_Node parse ## name (struct SDyn_Token *ntok)
+#define PARSER(name) static SDyn_Node parse ## name (struct SDyn_Token **ntok)
 PARSER(Top);
 PARSER(FunDecl);
 PARSER(VarDecl);
@@ -95,8 +97,14 @@ PARSER(Primary);
 /* the parser entry point */
 SDyn_Node sdyn_parse(const unsigned char *inp)
 {
-    struct SDyn_Token ntok = sdyn_tokenize(inp);
-    return parseTop(&ntok);
+    struct SDyn_Token *toks, *ntok;
+    SDyn_Node ret;
+
+    /* nodes keep copies of their tokens, so the array needn't outlive us */
+    toks = ntok = sdyn_tokenize(inp);
+    ret = parseTop(&ntok);
+    free(toks);
+    return ret;
 }
 
 PARSER(Top)
@@ -595,7 +603,7 @@ PARSER(PostfixExp)
 PARSER(LValOpt)
 {
     SDyn_Node ret = NULL;
-    struct SDyn_Token tok, start;
+    struct SDyn_Token tok, *start;
     int type;
 
     GGC_PUSH_1(ret);
@@ -693,6 +701,31 @@ PARSER(Primary)
     } else ERROR();
 }
 
+/* copy a parse tree into permanent space */
+SDyn_Node sdyn_permanentNode(SDyn_Node node)
+{
+    SDyn_NodeArray children = NULL;
+    SDyn_Node child = NULL;
+    size_t i;
+
+    if (!node) return NULL;
+
+    GGC_PUSH_3(node, children, child);
+
+    node = (SDyn_Node) ggggc_copyPermanent(node);
+    children = GGC_RP(node, children);
+    if (children) {
+        children = (SDyn_NodeArray) ggggc_copyPermanent(children);
+        GGC_WP(node, children, children);
+        for (i = 0; i < children->length; i++) {
+            child = sdyn_permanentNode(GGC_RAP(children, i));
+            GGC_WAP(children, i, child);
+        }
+    }
+
+    return node;
+}
+
 #ifdef USE_SDYN_PARSER_TEST
 #include "sja/buffer.h"
 
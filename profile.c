@@ -0,0 +1,286 @@
+/*
+ * SDyn: Sampling allocation profiler
+ *
+ * Copyright (c) 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* With SDYN_ALLOC_PROFILE=file in the environment, GGGGC samples about one
+ * allocation in every SDYN_ALLOC_SAMPLE bytes (default 128KiB), and each
+ * sample is charged to:
+ *  - the site in JIT code it came from, i.e. the function and the IR node
+ *    whose call led to it (see JCALL in the JIT),
+ *  - the runtime function that allocated it, found by walking the C stack up
+ *    out of GGGGC, and
+ *  - its SDyn type, from its descriptor's user data.
+ * The report is written to the file at exit, and whenever SIGUSR1 arrives
+ * (at the next sample, since it isn't safe to write it from the handler). */
+
+#define _DEFAULT_SOURCE /* for dladdr */
+#define _GNU_SOURCE /* for dladdr on older glibc */
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdyn/profile.h"
+#include "sdyn/value.h"
+
+int sdyn_allocProfiling = 0;
+size_t sdyn_allocSite = 0;
+
+/* sites in JIT code */
+struct AllocSite {
+    char *function;
+    size_t idx;
+    int op;
+};
+static struct AllocSite *sites = NULL;
+static size_t siteCount = 0, siteSize = 0;
+static char *currentFunction = NULL;
+
+/* the samples, by site, runtime function and type, in an open hash table */
+struct AllocSamples {
+    size_t site;
+    void *runtime;
+    int type;
+    unsigned long long samples, bytes, objects;
+};
+static struct AllocSamples *samples = NULL;
+static size_t sampleCount = 0, sampleSize = 0;
+
+static FILE *profileOut = NULL;
+static volatile sig_atomic_t reportRequested = 0;
+
+#define DEFAULT_SAMPLE 131072
+#define MAX_FRAMES 16
+
+/* find the runtime function that asked GGGGC for memory */
+static void *runtimeFunction()
+{
+    void *frames[MAX_FRAMES];
+    Dl_info info;
+    int count, i;
+
+    /* the stack can't be walked through JIT code, which has no unwind
+     * information, but the runtime function is below any of it. Static
+     * functions have no dynamic symbols, so GGGGC's internals and our own
+     * are skipped along with its API */
+    count = backtrace(frames, MAX_FRAMES);
+    for (i = 1; i < count; i++) {
+        if (dladdr(frames[i], &info) && info.dli_sname &&
+            strncmp(info.dli_sname, "ggggc_", 6))
+            return info.dli_saddr;
+    }
+    return NULL;
+}
+
+/* hash a sample key */
+static size_t sampleHash(size_t site, void *runtime, int type)
+{
+    return (site * 31 + ((size_t) runtime >> 4)) * 31 + type;
+}
+
+/* find (or make) the entry for a sample key */
+static struct AllocSamples *findSamples(size_t site, void *runtime, int type)
+{
+    struct AllocSamples *entry, *old;
+    size_t i, oldSize;
+
+    /* keep it at most half full */
+    if (sampleCount * 2 >= sampleSize) {
+        old = samples;
+        oldSize = sampleSize;
+        sampleSize = sampleSize ? sampleSize * 2 : 256;
+        samples = calloc(sampleSize, sizeof(struct AllocSamples));
+        if (!samples) {
+            perror("calloc");
+            abort();
+        }
+        sampleCount = 0;
+        for (i = 0; i < oldSize; i++) {
+            if (old[i].samples) {
+                entry = findSamples(old[i].site, old[i].runtime, old[i].type);
+                *entry = old[i];
+            }
+        }
+        free(old);
+    }
+
+    i = sampleHash(site, runtime, type) & (sampleSize - 1);
+    while (1) {
+        entry = &samples[i];
+        if (!entry->samples) {
+            entry->site = site;
+            entry->runtime = runtime;
+            entry->type = type;
+            sampleCount++;
+            return entry;
+        }
+        if (entry->site == site && entry->runtime == runtime && entry->type == type)
+            return entry;
+        i = (i + 1) & (sampleSize - 1);
+    }
+}
+
+/* the sampler, called by GGGGC */
+static void sampleAllocation(struct GGGGC_Descriptor *descriptor, ggc_size_t bytes, ggc_size_t weight)
+{
+    struct AllocSamples *entry;
+
+    /* descriptors SDyn didn't type have SDYN_TYPE_NIL */
+    int type = (int) descriptor->user__data;
+
+    entry = findSamples(sdyn_allocSite, runtimeFunction(), type);
+    entry->samples++;
+    entry->bytes += weight;
+    entry->objects += bytes > weight ? 1 : weight / bytes;
+
+    if (reportRequested) {
+        reportRequested = 0;
+        sdyn_allocProfileReport(profileOut);
+    }
+}
+
+static void requestReport(int sig)
+{
+    reportRequested = 1;
+}
+
+static void reportAtExit()
+{
+    sdyn_allocProfileReport(profileOut);
+}
+
+/* start profiling if SDYN_ALLOC_PROFILE names a file to report to */
+void sdyn_initAllocProfile()
+{
+    const char *path = getenv("SDYN_ALLOC_PROFILE");
+    const char *interval = getenv("SDYN_ALLOC_SAMPLE");
+    long sample = DEFAULT_SAMPLE;
+
+    if (!path || !path[0]) return;
+
+    profileOut = fopen(path, "w");
+    if (!profileOut) {
+        perror(path);
+        return;
+    }
+    if (interval && atol(interval) > 0)
+        sample = atol(interval);
+
+    sdyn_allocProfiling = 1;
+    ggggc_setAllocationSampler(sample, sampleAllocation);
+    signal(SIGUSR1, requestReport);
+    atexit(reportAtExit);
+}
+
+/* name the function whose sites are about to be made */
+void sdyn_allocProfileFunction(SDyn_Node func)
+{
+    size_t len = GGC_RD(func, tok).valLen;
+
+    currentFunction = malloc(len + 1);
+    if (!currentFunction) {
+        perror("malloc");
+        abort();
+    }
+    memcpy(currentFunction, GGC_RD(func, tok).val, len);
+    currentFunction[len] = 0;
+}
+
+/* make an allocation site for an IR node in the current function */
+size_t sdyn_allocProfileSite(size_t idx, int op)
+{
+    /* site 0 is C code, so JIT sites start at 1 */
+    if (siteCount + 1 >= siteSize) {
+        siteSize = siteSize ? siteSize * 2 : 256;
+        sites = realloc(sites, siteSize * sizeof(struct AllocSite));
+        if (!sites) {
+            perror("realloc");
+            abort();
+        }
+    }
+    siteCount++;
+    sites[siteCount].function = currentFunction ? currentFunction : "?";
+    sites[siteCount].idx = idx;
+    sites[siteCount].op = op;
+    return siteCount;
+}
+
+/* compare sample entries by bytes, most first */
+static int compareBytes(const void *l, const void *r)
+{
+    const struct AllocSamples *left = l, *right = r;
+    if (left->bytes != right->bytes)
+        return (left->bytes < right->bytes) ? 1 : -1;
+    return 0;
+}
+
+/* write out the profile so far */
+void sdyn_allocProfileReport(FILE *out)
+{
+    struct AllocSamples *sorted, byType[SDYN_TYPE_LAST];
+    unsigned long long totalBytes = 0;
+    size_t i, j;
+    Dl_info info;
+    const char *runtime;
+
+    /* pull them out of the hash table */
+    sorted = malloc((sampleCount + 1) * sizeof(struct AllocSamples));
+    if (!sorted) {
+        perror("malloc");
+        abort();
+    }
+    memset(byType, 0, sizeof(byType));
+    for (i = j = 0; i < sampleSize; i++) {
+        if (samples[i].samples) {
+            sorted[j++] = samples[i];
+            totalBytes += samples[i].bytes;
+            byType[samples[i].type].type = samples[i].type;
+            byType[samples[i].type].samples += samples[i].samples;
+            byType[samples[i].type].bytes += samples[i].bytes;
+            byType[samples[i].type].objects += samples[i].objects;
+        }
+    }
+    qsort(sorted, j, sizeof(struct AllocSamples), compareBytes);
+    qsort(byType, SDYN_TYPE_LAST, sizeof(struct AllocSamples), compareBytes);
+
+    fprintf(out, "SDyn allocation profile: about %llu bytes allocated\n\n", totalBytes);
+    fprintf(out, "%14s %12s %8s  %s\n", "bytes", "objects", "samples", "site");
+    for (i = 0; i < j; i++) {
+        runtime = "?";
+        if (sorted[i].runtime && dladdr(sorted[i].runtime, &info) && info.dli_sname)
+            runtime = info.dli_sname;
+        fprintf(out, "%14llu %12llu %8llu  ", sorted[i].bytes, sorted[i].objects, sorted[i].samples);
+        if (sorted[i].site)
+            fprintf(out, "%s:%lu %s", sites[sorted[i].site].function,
+                (unsigned long) sites[sorted[i].site].idx, sdyn_nodeNames[sites[sorted[i].site].op]);
+        else
+            fprintf(out, "(C)");
+        fprintf(out, " -> %s (%s)\n", runtime, sdyn_typeName(sorted[i].type));
+    }
+
+    fprintf(out, "\n%14s %12s %8s  %s\n", "bytes", "objects", "samples", "type");
+    for (i = 0; i < SDYN_TYPE_LAST && byType[i].samples; i++)
+        fprintf(out, "%14llu %12llu %8llu  %s\n", byType[i].bytes, byType[i].objects,
+            byType[i].samples, sdyn_typeName(byType[i].type));
+    fprintf(out, "\n");
+    fflush(out);
+
+    free(sorted);
+}
@@ -28,7 +28,8 @@ void sja_compile(struct SJA_Operation op, struct Buffer_uchar *buf, size_t *frel
 {
     size_t oi, ii, si;
     int bad;
-    unsigned char sz, needRex, *rex;
+    unsigned char sz, needRex;
+    size_t rex = 0;
     struct SJA_X8664_Encoding *enc;
 
     /* figure out the encoding for this instruction */
@@ -118,19 +119,21 @@ void sja_compile(struct SJA_Operation op, struct Buffer_uchar *buf, size_t *frel
 
     /* if we need a rex, do that first */
     if (needRex) {
+        /* remember where it is by index, since the buffer may move as the
+         * rest of the instruction is written */
         WRITE_ONE_BUFFER(*buf, 0x40);
-        rex = &buf->buf[buf->bufused-1];
+        rex = buf->bufused-1;
 
         if (sz > 4) {
             /* set the rex 'W' bit (i.e., write 64 bits) */
-            *rex |= (1<<3);
+            buf->buf[rex] |= (1<<3);
         }
     }
 
     /* some macros for setting the rex bits */
-#define REXB *rex |= 0x1
-#define REXX *rex |= 0x2
-#define REXR *rex |= 0x4
+#define REXB buf->buf[rex] |= 0x1
+#define REXX buf->buf[rex] |= 0x2
+#define REXR buf->buf[rex] |= 0x4
 
     /* need a specifier for 16-bit too */
     if (sz == 2)
@@ -0,0 +1,521 @@
+/*
+ * SDyn: Heap snapshots
+ *
+ * Copyright (c) 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* A heap snapshot is a JSON summary of everything live in the heap:
+ *  - totals for the heap, its objects and its free space, with a histogram
+ *    of free blocks by size (in powers of two),
+ *  - objects and bytes by SDyn type and by descriptor (the largest
+ *    SNAPSHOT_DESCRIPTORS of them),
+ *  - the size of the shape tree, which grows with every new object layout,
+ *    and
+ *  - for each member of the global object, the bytes it retains, i.e. what
+ *    would be freed if it were deleted.
+ * GGGGC walks the heap, and nothing is allocated while the snapshot is made,
+ * so the heap is seen as it is. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sdyn/snapshot.h"
+#include "sdyn/value.h"
+
+#define SNAPSHOT_DESCRIPTORS 32
+#define FREE_BUCKETS 64
+
+volatile sig_atomic_t sdyn_heapSnapshotRequested = 0;
+
+/* an object's owner, for finding what the globals retain: NONE until it's
+ * reached, OTHER if it's reachable other than through the globals, SHARED if
+ * it's reachable from more than one global, or else the global's index + 1 */
+#define OWNER_NONE      0
+#define OWNER_OTHER     ((size_t) -1)
+#define OWNER_SHARED    ((size_t) -2)
+
+/* every live object, in an open hash table */
+struct SnapObject {
+    void *obj;
+    ggc_size_t bytes;
+    size_t owner;
+    int inShapes;
+};
+
+/* objects and bytes of some kind */
+struct SnapCount {
+    void *key;
+    unsigned long long count, bytes;
+};
+
+struct Global {
+    const char *name;
+    size_t nameLen;
+    SDyn_Undefined value;
+    unsigned long long count, bytes;
+};
+
+struct Snapshot {
+    struct SnapObject *objects;
+    size_t objectCount, objectSize;
+
+    struct SnapCount *descriptors;
+    size_t descriptorCount, descriptorSize;
+
+    struct SnapCount types[SDYN_TYPE_LAST];
+    struct SnapCount free[FREE_BUCKETS];
+    unsigned long long objectBytes, freeBytes, freeBlocks;
+
+    struct SnapCount shapes;
+    size_t shapeDepth, shapeChildren;
+
+    struct Global *globals;
+    size_t globalCount;
+
+    /* the stack of objects to visit */
+    void **stack;
+    size_t stackUsed, stackSize;
+    size_t label;
+};
+
+static void *snapAlloc(size_t sz)
+{
+    void *ret = calloc(1, sz);
+    if (!ret) {
+        perror("calloc");
+        abort();
+    }
+    return ret;
+}
+
+static size_t ptrHash(void *ptr)
+{
+    return ((size_t) ptr >> 3) * 0x9E3779B97F4A7C15UL;
+}
+
+/* find an object's entry, or where it would go */
+static struct SnapObject *findSlot(struct SnapObject *objects, size_t size, void *obj)
+{
+    size_t i = ptrHash(obj) & (size - 1);
+    while (objects[i].obj && objects[i].obj != obj)
+        i = (i + 1) & (size - 1);
+    return &objects[i];
+}
+
+static struct SnapObject *findObject(struct Snapshot *snap, void *obj)
+{
+    struct SnapObject *entry;
+    /* a collector that can't walk its heap leaves us nothing */
+    if (!snap->objects) return NULL;
+    entry = findSlot(snap->objects, snap->objectSize, obj);
+    return entry->obj ? entry : NULL;
+}
+
+static void addObject(struct Snapshot *snap, void *obj, ggc_size_t bytes)
+{
+    struct SnapObject *old = snap->objects, *entry;
+    size_t i, oldSize = snap->objectSize;
+
+    /* keep it at most half full */
+    if (snap->objectCount * 2 >= snap->objectSize) {
+        snap->objectSize = oldSize ? oldSize * 2 : 4096;
+        snap->objects = snapAlloc(snap->objectSize * sizeof(struct SnapObject));
+        for (i = 0; i < oldSize; i++) {
+            if (old[i].obj)
+                *findSlot(snap->objects, snap->objectSize, old[i].obj) = old[i];
+        }
+        free(old);
+    }
+
+    entry = findSlot(snap->objects, snap->objectSize, obj);
+    entry->obj = obj;
+    entry->bytes = bytes;
+    snap->objectCount++;
+}
+
+/* count an object against its descriptor */
+static void countDescriptor(struct Snapshot *snap, void *descriptor, ggc_size_t bytes)
+{
+    struct SnapCount *old = snap->descriptors, *entry;
+    size_t i, j, oldSize = snap->descriptorSize;
+
+    if (snap->descriptorCount * 2 >= snap->descriptorSize) {
+        snap->descriptorSize = oldSize ? oldSize * 2 : 256;
+        snap->descriptors = snapAlloc(snap->descriptorSize * sizeof(struct SnapCount));
+        for (i = 0; i < oldSize; i++) {
+            if (!old[i].key) continue;
+            j = ptrHash(old[i].key) & (snap->descriptorSize - 1);
+            while (snap->descriptors[j].key)
+                j = (j + 1) & (snap->descriptorSize - 1);
+            snap->descriptors[j] = old[i];
+        }
+        free(old);
+    }
+
+    i = ptrHash(descriptor) & (snap->descriptorSize - 1);
+    while (snap->descriptors[i].key && snap->descriptors[i].key != descriptor)
+        i = (i + 1) & (snap->descriptorSize - 1);
+    entry = &snap->descriptors[i];
+    if (!entry->key) {
+        entry->key = descriptor;
+        snap->descriptorCount++;
+    }
+    entry->count++;
+    entry->bytes += bytes;
+}
+
+/* the SDyn type of objects with this descriptor, or SDYN_TYPE_NIL */
+static int descriptorType(struct GGGGC_Descriptor *descriptor)
+{
+    /* SDyn only ever puts types in descriptors' user data, and others are 0 */
+    return (int) descriptor->user__data;
+}
+
+/* GGGGC's heap visitor */
+static void visitHeap(void *arg, void *obj, struct GGGGC_Descriptor *descriptor, ggc_size_t bytes)
+{
+    struct Snapshot *snap = arg;
+    int bucket;
+
+    if (!descriptor) {
+        bucket = GGGGC_BITS_PER_WORD - 1 - __builtin_clzl(bytes);
+        snap->free[bucket].count++;
+        snap->free[bucket].bytes += bytes;
+        snap->freeBlocks++;
+        snap->freeBytes += bytes;
+        return;
+    }
+
+    addObject(snap, obj, bytes);
+    countDescriptor(snap, descriptor, bytes);
+    snap->types[descriptorType(descriptor)].count++;
+    snap->types[descriptorType(descriptor)].bytes += bytes;
+    snap->objectBytes += bytes;
+}
+
+static void push(struct Snapshot *snap, void *obj)
+{
+    if (snap->stackUsed == snap->stackSize) {
+        snap->stackSize = snap->stackSize ? snap->stackSize * 2 : 1024;
+        snap->stack = realloc(snap->stack, snap->stackSize * sizeof(void *));
+        if (!snap->stack) {
+            perror("realloc");
+            abort();
+        }
+    }
+    snap->stack[snap->stackUsed++] = obj;
+}
+
+/* reach an object, owned by the current label. An object reached from two
+ * globals is shared, and so is everything it reaches. */
+static void reach(void *arg, void *obj)
+{
+    struct Snapshot *snap = arg;
+    struct SnapObject *entry = findObject(snap, obj);
+    size_t label = snap->label;
+
+    if (!entry || entry->owner == OWNER_OTHER || entry->owner == OWNER_SHARED ||
+        entry->owner == label)
+        return;
+    if (entry->owner != OWNER_NONE)
+        label = OWNER_SHARED;
+    entry->owner = label;
+    push(snap, obj);
+}
+
+/* reach everything we can from the stack, except through cut */
+static void reachAll(struct Snapshot *snap, void *cut)
+{
+    void *obj;
+    size_t label = snap->label;
+
+    while (snap->stackUsed) {
+        obj = snap->stack[--snap->stackUsed];
+        if (obj == cut) continue;
+        snap->label = findObject(snap, obj)->owner;
+        ggggc_walkObject(obj, reach, snap);
+    }
+    snap->label = label;
+}
+
+/* find what each global retains */
+static void findRetained(struct Snapshot *snap)
+{
+    SDyn_Shape shape = GGC_RP(sdyn_globalObject, shape);
+    SDyn_IndexMap members = GGC_RP(shape, members);
+    SDyn_IndexMapEntryArray entries = GGC_RP(members, entries);
+    SDyn_IndexMapEntry entry;
+    SDyn_UndefinedArray values = GGC_RP(sdyn_globalObject, members);
+    SDyn_String name;
+    struct SnapObject *object;
+    size_t i, g;
+
+    /* the members, by name */
+    snap->globals = snapAlloc((GGC_RD(members, used) + 1) * sizeof(struct Global));
+    for (i = 0; entries && i < entries->length; i++) {
+        for (entry = GGC_RAP(entries, i); entry; entry = GGC_RP(entry, next)) {
+            name = GGC_RP(entry, key);
+            if (!name) continue;
+            g = snap->globalCount++;
+            snap->globals[g].name = name->a__data;
+            snap->globals[g].nameLen = GGC_RD(name, length);
+            snap->globals[g].value = GGC_RAP(values, GGC_RD(GGC_RP(entry, value), v));
+        }
+    }
+
+    /* everything reachable without going through the globals' values is
+     * retained by something else */
+    snap->label = OWNER_OTHER;
+    ggggc_walkRoots(reach, snap);
+    reachAll(snap, values);
+
+    /* then each global's */
+    for (g = 0; g < snap->globalCount; g++) {
+        snap->label = g + 1;
+        reach(snap, snap->globals[g].value);
+        reachAll(snap, NULL);
+    }
+
+    for (i = 0; i < snap->objectSize; i++) {
+        object = &snap->objects[i];
+        if (object->obj && object->owner != OWNER_NONE && object->owner < OWNER_SHARED) {
+            snap->globals[object->owner - 1].count++;
+            snap->globals[object->owner - 1].bytes += object->bytes;
+        }
+    }
+}
+
+/* count an object as part of the shape tree, once */
+static void countShapeObject(struct Snapshot *snap, void *obj)
+{
+    struct SnapObject *entry;
+    if (!obj) return;
+    entry = findObject(snap, obj);
+    if (!entry || entry->inShapes) return;
+    entry->inShapes = 1;
+    snap->shapes.bytes += entry->bytes;
+}
+
+/* measure the shape tree: the shapes, and their maps of children and
+ * members, but not the names in them, which belong to the program */
+static void measureShapes(struct Snapshot *snap)
+{
+    SDyn_Shape shape;
+    SDyn_ShapeMap children;
+    SDyn_ShapeMapEntryArray childEntries;
+    SDyn_ShapeMapEntry childEntry;
+    SDyn_IndexMap members;
+    SDyn_IndexMapEntryArray memberEntries;
+    SDyn_IndexMapEntry memberEntry;
+    size_t i, depth;
+
+    /* depth-first, with each shape's depth pushed under it */
+    push(snap, (void *) 0);
+    push(snap, sdyn_emptyShape);
+    while (snap->stackUsed) {
+        shape = snap->stack[--snap->stackUsed];
+        depth = (size_t) snap->stack[--snap->stackUsed];
+        snap->shapes.count++;
+        if (depth > snap->shapeDepth) snap->shapeDepth = depth;
+        countShapeObject(snap, shape);
+
+        children = GGC_RP(shape, children);
+        countShapeObject(snap, children);
+        if (GGC_RD(children, used) > snap->shapeChildren)
+            snap->shapeChildren = GGC_RD(children, used);
+        childEntries = GGC_RP(children, entries);
+        countShapeObject(snap, childEntries);
+        for (i = 0; childEntries && i < childEntries->length; i++) {
+            for (childEntry = GGC_RAP(childEntries, i); childEntry;
+                 childEntry = GGC_RP(childEntry, next)) {
+                countShapeObject(snap, childEntry);
+                push(snap, (void *) (depth + 1));
+                push(snap, GGC_RP(childEntry, value));
+            }
+        }
+
+        members = GGC_RP(shape, members);
+        countShapeObject(snap, members);
+        memberEntries = GGC_RP(members, entries);
+        countShapeObject(snap, memberEntries);
+        for (i = 0; memberEntries && i < memberEntries->length; i++) {
+            for (memberEntry = GGC_RAP(memberEntries, i); memberEntry;
+                 memberEntry = GGC_RP(memberEntry, next)) {
+                countShapeObject(snap, memberEntry);
+                countShapeObject(snap, GGC_RP(memberEntry, value));
+            }
+        }
+    }
+}
+
+/* sort counts by bytes, most first */
+static int compareBytes(const void *l, const void *r)
+{
+    const struct SnapCount *left = l, *right = r;
+    if (left->bytes != right->bytes)
+        return (left->bytes < right->bytes) ? 1 : -1;
+    return 0;
+}
+
+static int compareGlobals(const void *l, const void *r)
+{
+    const struct Global *left = l, *right = r;
+    if (left->bytes != right->bytes)
+        return (left->bytes < right->bytes) ? 1 : -1;
+    return 0;
+}
+
+/* write a string as JSON */
+static void writeString(FILE *out, const char *str, size_t len)
+{
+    size_t i;
+    unsigned char c;
+
+    fputc('"', out);
+    for (i = 0; i < len; i++) {
+        c = str[i];
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void writeSnapshot(FILE *out, struct Snapshot *snap)
+{
+    struct GGGGC_Stats stats;
+    struct SnapCount *descriptors;
+    struct GGGGC_Descriptor *descriptor;
+    size_t i, j;
+    int type;
+
+    ggggc_getStats(&stats);
+    fprintf(out, "{\"heapBytes\":%lu,\"largeBytes\":%lu,\"permanentBytes\":%lu,"
+        "\"objects\":%lu,\"objectBytes\":%llu,"
+        "\"freeBlocks\":%llu,\"freeBytes\":%llu,\n",
+        (unsigned long) stats.heapBytes, (unsigned long) stats.largeBytes,
+        (unsigned long) stats.permanentBytes,
+        (unsigned long) snap->objectCount, snap->objectBytes,
+        snap->freeBlocks, snap->freeBytes);
+
+    /* free blocks, by the power of two below their size */
+    fprintf(out, "\"free\":[");
+    for (i = j = 0; i < FREE_BUCKETS; i++) {
+        if (!snap->free[i].count) continue;
+        fprintf(out, "%s{\"minBytes\":%lu,\"blocks\":%llu,\"bytes\":%llu}",
+            j++ ? "," : "", 1UL << i, snap->free[i].count, snap->free[i].bytes);
+    }
+    fprintf(out, "],\n");
+
+    fprintf(out, "\"types\":{");
+    for (type = j = 0; type < SDYN_TYPE_LAST; type++) {
+        if (!snap->types[type].count) continue;
+        fprintf(out, "%s\"%s\":{\"objects\":%llu,\"bytes\":%llu}",
+            j++ ? "," : "", sdyn_typeName(type), snap->types[type].count, snap->types[type].bytes);
+    }
+    fprintf(out, "},\n");
+
+    /* the descriptors with the most bytes */
+    descriptors = snapAlloc((snap->descriptorCount + 1) * sizeof(struct SnapCount));
+    for (i = j = 0; i < snap->descriptorSize; i++) {
+        if (snap->descriptors[i].key)
+            descriptors[j++] = snap->descriptors[i];
+    }
+    qsort(descriptors, j, sizeof(struct SnapCount), compareBytes);
+    fprintf(out, "\"descriptors\":[");
+    for (i = 0; i < j && i < SNAPSHOT_DESCRIPTORS; i++) {
+        descriptor = descriptors[i].key;
+        fprintf(out, "%s\n{\"descriptor\":\"%p\",\"words\":%lu,\"type\":\"%s\","
+            "\"objects\":%llu,\"bytes\":%llu}",
+            i ? "," : "", (void *) descriptor, (unsigned long) descriptor->size,
+            sdyn_typeName(descriptorType(descriptor)), descriptors[i].count, descriptors[i].bytes);
+    }
+    fprintf(out, "],\n\"otherDescriptors\":%lu,\n",
+        (unsigned long) (j > SNAPSHOT_DESCRIPTORS ? j - SNAPSHOT_DESCRIPTORS : 0));
+    free(descriptors);
+
+    fprintf(out, "\"shapes\":{\"shapes\":%llu,\"bytes\":%llu,\"maxDepth\":%lu,"
+        "\"maxChildren\":%lu},\n",
+        snap->shapes.count, snap->shapes.bytes, (unsigned long) snap->shapeDepth,
+        (unsigned long) snap->shapeChildren);
+
+    /* and what the globals retain */
+    qsort(snap->globals, snap->globalCount, sizeof(struct Global), compareGlobals);
+    fprintf(out, "\"globals\":[");
+    for (i = 0; i < snap->globalCount; i++) {
+        fprintf(out, "%s\n{\"name\":", i ? "," : "");
+        writeString(out, snap->globals[i].name, snap->globals[i].nameLen);
+        fprintf(out, ",\"type\":\"%s\",\"retainedObjects\":%llu,\"retainedBytes\":%llu}",
+            sdyn_typeName(descriptorType(snap->globals[i].value->header.descriptor__ptr)),
+            snap->globals[i].count, snap->globals[i].bytes);
+    }
+    fprintf(out, "]}\n");
+}
+
+/* write a snapshot of the heap */
+void sdyn_heapSnapshot(FILE *out)
+{
+    struct Snapshot snap;
+
+    memset(&snap, 0, sizeof(snap));
+    ggggc_walkHeap(visitHeap, &snap);
+    measureShapes(&snap);
+    findRetained(&snap);
+    writeSnapshot(out, &snap);
+    fflush(out);
+
+    free(snap.objects);
+    free(snap.descriptors);
+    free(snap.globals);
+    free(snap.stack);
+}
+
+/* write a snapshot to a file */
+const char *sdyn_heapSnapshotFile(const char *path)
+{
+    static char defaultPath[64];
+    static unsigned int snapshots = 0;
+    FILE *out;
+
+    if (!path) {
+        snprintf(defaultPath, sizeof(defaultPath), "sdyn-heap.%ld.%u.json",
+            (long) getpid(), ++snapshots);
+        path = defaultPath;
+    }
+
+    out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return NULL;
+    }
+    sdyn_heapSnapshot(out);
+    fclose(out);
+    return path;
+}
+
+static void requestSnapshot(int sig)
+{
+    sdyn_heapSnapshotRequested = 1;
+}
+
+/* take snapshots on SIGUSR2 */
+void sdyn_initHeapSnapshot()
+{
+    signal(SIGUSR2, requestSnapshot);
+}
@@ -16,212 +16,224 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "sja/buffer.h"
+
 #include "sdyn/tokenizer.h"
 
-static int isWhite(unsigned char c)
-{
-    return ((c == ' ') ||
-            (c == '\t') ||
-            (c == '\n') ||
-            (c == '\r'));
-}
+BUFFER(SDyn_Token, struct SDyn_Token);
+
+/* what each character may begin. Anything not listed is a symbol (or an
+ * error, if it isn't one of ours) */
+enum CharClass {
+    CC_SYMBOL = 0,
+    CC_END,
+    CC_WHITE,
+    CC_NEWLINE,
+    CC_ALPHA,
+    CC_DIGIT,
+    CC_INTRINSIC,
+    CC_STRING
+};
+
+static const unsigned char charClasses[256] = {
+    ['\0'] = CC_END,
+    [' '] = CC_WHITE, ['\t'] = CC_WHITE, ['\r'] = CC_WHITE,
+    ['\n'] = CC_NEWLINE,
+    ['a' ... 'z'] = CC_ALPHA, ['A' ... 'Z'] = CC_ALPHA,
+    ['0' ... '9'] = CC_DIGIT,
+    ['$'] = CC_INTRINSIC,
+    ['"'] = CC_STRING
+};
+
+/* symbols: the token for the character alone, and the token for it followed
+ * by second, if any */
+static const struct Symbol {
+    unsigned char one, second, two;
+} symbols[256] = {
+    ['('] = {SDYN_TOKEN_LPAREN},
+    [')'] = {SDYN_TOKEN_RPAREN},
+    ['{'] = {SDYN_TOKEN_LBRACE},
+    ['}'] = {SDYN_TOKEN_RBRACE},
+    ['['] = {SDYN_TOKEN_LBRACKET},
+    [']'] = {SDYN_TOKEN_RBRACKET},
+    [';'] = {SDYN_TOKEN_SEMICOLON},
+    [','] = {SDYN_TOKEN_COMMA},
+    ['+'] = {SDYN_TOKEN_ADD},
+    ['-'] = {SDYN_TOKEN_SUB},
+    ['*'] = {SDYN_TOKEN_MUL},
+    ['%'] = {SDYN_TOKEN_MOD},
+    ['/'] = {SDYN_TOKEN_DIV},
+    ['~'] = {SDYN_TOKEN_BNOT},
+    ['.'] = {SDYN_TOKEN_DOT},
+    ['|'] = {SDYN_TOKEN_ERR, '|', SDYN_TOKEN_OR},
+    ['&'] = {SDYN_TOKEN_ERR, '&', SDYN_TOKEN_AND},
+    ['='] = {SDYN_TOKEN_ASSIGN, '=', SDYN_TOKEN_EQ},
+    ['!'] = {SDYN_TOKEN_NOT, '=', SDYN_TOKEN_NE},
+    ['<'] = {SDYN_TOKEN_LT, '=', SDYN_TOKEN_LE},
+    ['>'] = {SDYN_TOKEN_GT, '=', SDYN_TOKEN_GE}
+};
+
+/* keywords, by a perfect hash of their first two characters and length. All
+ * keywords have at least two characters */
+#define KEYWORD_HASH(inp, len) (((inp)[0] + ((inp)[1] << 3) + (len)) & 15)
+static const struct Keyword {
+    const char *name;
+    size_t len;
+    enum SDyn_TokenType type;
+} keywords[16] = {
+#define KEY(k, h) [h] = {#k, sizeof(#k)-1, SDYN_TOKEN_ ## k}
+    KEY(else, 9),
+    KEY(false, 3),
+    KEY(function, 6),
+    KEY(if, 11),
+    KEY(null, 10),
+    KEY(return, 0),
+    KEY(true, 8),
+    KEY(typeof, 2),
+    KEY(var, 1),
+    KEY(while, 12)
+#undef KEY
+};
 
-/* get a single token from the input */
-struct SDyn_Token sdyn_tokenize(const unsigned char *inp)
+/* tokenize the whole input. The token array ends with an EOF token, and
+ * should be freed with free() */
+struct SDyn_Token *sdyn_tokenize(const unsigned char *inp)
 {
-    struct SDyn_Token ret;
-    memset(&ret, 0, sizeof(ret));
+    struct Buffer_SDyn_Token buf;
+    struct SDyn_Token tok;
+    const unsigned char *lineStart = inp;
+    unsigned int line = 1;
+    size_t len;
+
+    INIT_BUFFER(buf);
+    memset(&tok, 0, sizeof(tok));
 
-    /* skip whitespace and comments */
     while (1) {
-        while (isWhite(*inp)) inp++;
-        if (inp[0] == '/') {
-            if (inp[1] == '/') {
-                /* line comment */
-                inp += 2;
-                while (*inp && *inp != '\n') inp++;
-            } else if (inp[1] == '*') {
+        /* skip whitespace and comments */
+        while (1) {
+            unsigned char cc = charClasses[*inp];
+            if (cc == CC_WHITE) {
+                inp++;
+
+            } else if (cc == CC_NEWLINE) {
+                inp++;
+                line++;
+                lineStart = inp;
+
+            } else if (inp[0] == '/' && inp[1] == '/') {
+                /* line comment. The newline itself is skipped above. libc's
+                 * strchr is vectorized, so let it do the looking */
+                const unsigned char *nl = (const unsigned char *) strchr((const char *) inp, '\n');
+                inp = nl ? nl : inp + strlen((const char *) inp);
+
+            } else if (inp[0] == '/' && inp[1] == '*') {
                 /* block comment */
                 inp += 2;
-                while (*inp && (inp[0] != '*' || inp[1] != '/')) inp++;
+                while (*inp && (inp[0] != '*' || inp[1] != '/')) {
+                    if (*inp == '\n') {
+                        line++;
+                        lineStart = inp + 1;
+                    }
+                    inp++;
+                }
                 if (*inp) inp += 2;
-            } else break;
-        } else break;
-    }
-
-    /* if there's no more input, so be it */
-    if (!*inp) {
-        ret.type = SDYN_TOKEN_EOF;
-        return ret;
-    }
-    ret.val = inp;
-
-    /* is it an identifier or intrinsic? */
-    if ((*inp >= 'a' && *inp <= 'z') ||
-        (*inp >= 'A' && *inp <= 'Z') ||
-        (*inp == '$')) {
-        size_t len;
-
-        /* yes. Get the rest */
-        for (len = 1;
-             ((inp[len] >= 'a' && inp[len] <= 'z') ||
-              (inp[len] >= 'A' && inp[len] <= 'Z') ||
-              (inp[len] >= '0' && inp[len] <= '9'));
-             len++);
-
-        /* set up the return */
-        ret.type = (*inp == '$') ? SDYN_TOKEN_INTRINSIC : SDYN_TOKEN_ID;
-        ret.valLen = len;
-
-        /* and special-case our keywords */
-#define KEY(k) \
-        if (sizeof(#k)-1 == len && !strncmp(#k, inp, len)) \
-            ret.type = SDYN_TOKEN_ ## k
-        KEY(else);
-        else KEY(false);
-        else KEY(function);
-        else KEY(if);
-        else KEY(null);
-        else KEY(return);
-        else KEY(true);
-        else KEY(typeof);
-        else KEY(var);
-        else KEY(while);
-#undef KEY
-
-        return ret;
-    }
 
-    /* is it a number? */
-    if (*inp >= '0' && *inp <= '9') {
-        size_t len;
-
-        /* yes. Get the rest */
-        for (len = 1;
-             inp[len] >= '0' && inp[len] <= '9';
-             len++);
-
-        /* set up the return */
-        ret.type = SDYN_TOKEN_NUM;
-        ret.valLen = len;
-        return ret;
-    }
+            } else break;
+        }
 
-    /* is it a string literal? */
-    if (*inp == '"') {
-        size_t len;
+        tok.val = inp;
+        tok.line = line;
+        tok.col = inp - lineStart + 1;
+
+        switch (charClasses[*inp]) {
+            case CC_END:
+                /* if there's no more input, so be it */
+                tok.type = SDYN_TOKEN_EOF;
+                tok.valLen = 0;
+                WRITE_ONE_BUFFER(buf, tok);
+                return buf.buf;
+
+            case CC_ALPHA:
+            case CC_INTRINSIC:
+            {
+                const struct Keyword *key;
+
+                for (len = 1;
+                     charClasses[inp[len]] == CC_ALPHA || charClasses[inp[len]] == CC_DIGIT;
+                     len++);
+                tok.type = (*inp == '$') ? SDYN_TOKEN_INTRINSIC : SDYN_TOKEN_ID;
+                tok.valLen = len;
+
+                /* and special-case our keywords */
+                if (len > 1) {
+                    key = &keywords[KEYWORD_HASH(inp, len)];
+                    if (key->len == len && !memcmp(key->name, inp, len))
+                        tok.type = key->type;
+                }
+                break;
+            }
 
-        /* yes. Get the rest */
-        for (len = 1; inp[len] && inp[len] != '"'; len++) {
-            if (inp[len] == '\\') {
-                if (inp[len+1])
-                    len++;
+            case CC_DIGIT:
+                for (len = 1; charClasses[inp[len]] == CC_DIGIT; len++);
+                tok.type = SDYN_TOKEN_NUM;
+                tok.valLen = len;
+                break;
+
+            case CC_STRING:
+                for (len = 1; inp[len] && inp[len] != '"'; len++) {
+                    if (inp[len] == '\\') {
+                        if (inp[len+1])
+                            len++;
+                    }
+                    if (inp[len] == '\n') {
+                        line++;
+                        lineStart = inp + len + 1;
+                    }
+                }
+                if (inp[len] == '"') len++;
+                tok.type = SDYN_TOKEN_STR;
+                tok.valLen = len;
+                break;
+
+            default:
+            {
+                /* a symbol, or an error */
+                const struct Symbol *sym = &symbols[*inp];
+                if (sym->second && inp[1] == sym->second) {
+                    tok.type = (enum SDyn_TokenType) sym->two;
+                    tok.valLen = 2;
+                } else {
+                    tok.type = (enum SDyn_TokenType) sym->one;
+                    tok.valLen = 1;
+                }
+                break;
             }
         }
-        if (inp[len] == '"') len++;
-
-        /* set up the return */
-        ret.type = SDYN_TOKEN_STR;
-        ret.valLen = len;
-        return ret;
-    }
 
-    /* all the simple one-character symbols */
-#define SYM(s, ch) \
-    if (*inp == ch) do { \
-        ret.type = SDYN_TOKEN_ ## s; \
-        ret.valLen = 1; \
-        return ret; \
-    } while(0)
-    SYM(LPAREN, '(');
-    else SYM(RPAREN, ')');
-    else SYM(LBRACE, '{');
-    else SYM(RBRACE, '}');
-    else SYM(LBRACKET, '[');
-    else SYM(RBRACKET, ']');
-    else SYM(SEMICOLON, ';');
-    else SYM(COMMA, ',');
-    else SYM(ADD, '+');
-    else SYM(SUB, '-');
-    else SYM(MUL, '*');
-    else SYM(MOD, '%');
-    else SYM(DIV, '/');
-    else SYM(BNOT, '~');
-    else SYM(DOT, '.');
-#undef SYM
-
-    /* and now for all the two-character symbols */
-#define SYM2(s, ch) if (inp[1] == ch) do { \
-    ret.type = SDYN_TOKEN_ ## s; \
-    ret.valLen = 2; \
-    return ret; \
-} while(0)
-#define SYM1(s) do { \
-    ret.type = SDYN_TOKEN_ ## s; \
-    ret.valLen = 1; \
-    return ret; \
-} while(0)
-    switch (*inp) {
-        case '|':
-            SYM2(OR, '|');
-            break;
-
-        case '&':
-            SYM2(AND, '&');
-            break;
-
-        case '=':
-            SYM2(EQ, '=');
-            else SYM1(ASSIGN);
-
-        case '!':
-            SYM2(NE, '=');
-            else SYM1(NOT);
-
-        case '<':
-            SYM2(LE, '=');
-            else SYM1(LT);
-
-        case '>':
-            SYM2(GE, '=');
-            else SYM1(GT);
+        WRITE_ONE_BUFFER(buf, tok);
+        inp += tok.valLen;
     }
-#undef SYM1
-#undef SYM2
-
-    /* all else failed! */
-    ret.type = SDYN_TOKEN_ERR;
-    ret.valLen = 1;
-    return ret;
 }
 
 #ifdef USE_SDYN_TOKENIZER_TEST
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/types.h>
-
-#include "sja/buffer.h"
-
 int main()
 {
     struct Buffer_char buf;
-    struct SDyn_Token tok;
-    const unsigned char *cur;
+    struct SDyn_Token *toks, *tok;
 
     INIT_BUFFER(buf);
     READ_FILE_BUFFER(buf, stdin);
     WRITE_ONE_BUFFER(buf, 0);
-    cur = (unsigned char *) buf.buf;
-
-    while (1) {
-        tok = sdyn_tokenize(cur);
-        if (tok.type == SDYN_TOKEN_EOF) break;
-        cur = tok.val + tok.valLen;
 
-        printf("Token %d: %.*s\n", tok.type, (int) tok.valLen, (char *) tok.val);
-    }
+    toks = sdyn_tokenize((unsigned char *) buf.buf);
+    for (tok = toks; tok->type != SDYN_TOKEN_EOF; tok++)
+        printf("Token %d (%u:%u): %.*s\n", tok->type, tok->line, tok->col,
+            (int) tok->valLen, (char *) tok->val);
+    free(toks);
 
     return 0;
 }
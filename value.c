@@ -20,45 +20,56 @@
 
 #define _BSD_SOURCE /* for MAP_ANON */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
 #include "sdyn/jit.h"
+#include "sdyn/profile.h"
+#include "sdyn/snapshot.h"
 #include "sdyn/value.h"
 
-/* map functions */
-size_t SDyn_ShapeMapStringHash(SDyn_String str)
+/* the flat version of a string if it has one already, or NULL if getting one
+ * would need allocation */
+static SDyn_String flatString(SDyn_String str)
 {
-    GGC_char_Array arr = NULL;
-    size_t i, ret = 0;
+    SDyn_String left;
+    GGC_NO_GC();
+
+    left = GGC_RP(str, left);
+    if (!left) return str;
+    if (!GGC_RP(str, right)) return left;
+    return NULL;
+}
 
-    GGC_PUSH_2(str, arr);
-    arr = GGC_RP(str, value);
+/* map functions, with leaf versions for flat strings */
+static size_t flatHash(SDyn_String str)
+{
+    size_t i, len, ret = 0;
+    GGC_NO_GC();
 
-    for (i = 0; i < arr->length; i++)
-        ret = ((unsigned char) GGC_RAD(arr, i)) + (ret << 16) - ret;
+    len = GGC_RD(str, length);
+    for (i = 0; i < len; i++)
+        ret = ((unsigned char) GGC_RAD(str, i)) + (ret << 16) - ret;
 
     return ret;
 }
 
-int SDyn_ShapeMapStringCmp(SDyn_String strl, SDyn_String strr)
+static int flatCmp(SDyn_String strl, SDyn_String strr)
 {
-    GGC_char_Array arrl = NULL, arrr = NULL;
     size_t lenl, lenr, minlen;
     int ret;
+    GGC_NO_GC();
 
-    GGC_PUSH_4(strl, strr, arrl, arrr);
-    arrl = GGC_RP(strl, value);
-    arrr = GGC_RP(strr, value);
-    lenl = arrl->length;
-    lenr = arrr->length;
+    lenl = GGC_RD(strl, length);
+    lenr = GGC_RD(strr, length);
     if (lenl < lenr) minlen = lenl;
     else minlen = lenr;
 
     /* do the direct comparison */
-    ret = memcmp(arrl->a__data, arrr->a__data, minlen);
+    ret = memcmp(strl->a__data, strr->a__data, minlen);
 
     /* then adjust for length */
     if (ret == 0) {
@@ -69,15 +80,78 @@ int SDyn_ShapeMapStringCmp(SDyn_String strl, SDyn_String strr)
     return ret;
 }
 
+size_t SDyn_ShapeMapStringHash(SDyn_String str)
+{
+    /* str isn't used after flattening, so needn't be pushed */
+    return flatHash(sdyn_flattenString(str));
+}
+
+int SDyn_ShapeMapStringCmp(SDyn_String strl, SDyn_String strr)
+{
+    SDyn_String flatl, flatr;
+
+    flatl = flatString(strl);
+    flatr = flatString(strr);
+    if (!flatl || !flatr) {
+        GGC_PUSH_2(strl, strr);
+        strl = sdyn_flattenString(strl);
+        strr = sdyn_flattenString(strr);
+        return flatCmp(strl, strr);
+    }
+
+    return flatCmp(flatl, flatr);
+}
+
 /* important global values */
 SDyn_Undefined sdyn_undefined = NULL;
 SDyn_Boolean sdyn_false = NULL, sdyn_true = NULL;
 SDyn_Shape sdyn_emptyShape = NULL;
 SDyn_Object sdyn_globalObject = NULL;
+SDyn_NumberArray sdyn_smallInts = NULL;
+
+/* immortal strings for the constant results of sdyn_toString and
+ * sdyn_typeof */
+enum SDyn_ConstantString {
+    SDYN_CSTR_UNDEFINED,
+    SDYN_CSTR_TRUE,
+    SDYN_CSTR_FALSE,
+    SDYN_CSTR_OBJECT_OBJECT,
+    SDYN_CSTR_FUNCTION_FUNCTION,
+    SDYN_CSTR_ERROR,
+    SDYN_CSTR_BOOLEAN,
+    SDYN_CSTR_NUMBER,
+    SDYN_CSTR_STRING,
+    SDYN_CSTR_OBJECT,
+    SDYN_CSTR_FUNCTION,
+    SDYN_CSTR_UNKNOWN,
+    SDYN_CSTR_COUNT
+};
+static const char *constantStringValues[SDYN_CSTR_COUNT] = {
+    "undefined",
+    "true",
+    "false",
+    "[object Object]",
+    "[function]",
+    "[ERROR!]",
+    "boolean",
+    "number",
+    "string",
+    "object",
+    "function",
+    "???"
+};
+static SDyn_StringArray constantStrings = NULL;
+
+/* strings are variable-sized, so each size (in words) of string needs its own
+ * descriptor. Up to SDYN_STRING_DESCRIPTORS words, these are shared by all
+ * strings of that size; larger strings get their own. */
+#define SDYN_STRING_DESCRIPTORS 256
+static GGC_voidpArray stringDescriptors = NULL;
 
 static void pushGlobals()
 {
-    GGC_PUSH_5(sdyn_undefined, sdyn_false, sdyn_true, sdyn_emptyShape, sdyn_globalObject);
+    GGC_PUSH_8(sdyn_undefined, sdyn_false, sdyn_true, sdyn_emptyShape, sdyn_globalObject,
+        sdyn_smallInts, stringDescriptors, constantStrings);
     GGC_GLOBALIZE();
     return;
 }
@@ -85,68 +159,73 @@ static void pushGlobals()
 /* and our global value initializer */
 void sdyn_initValues()
 {
-    SDyn_Tag tag = NULL;
     SDyn_Number number = NULL;
-    SDyn_String string = NULL;
     SDyn_ShapeMap esm = NULL;
     SDyn_IndexMap eim = NULL;
     SDyn_UndefinedArray em = NULL;
     SDyn_Function func = NULL;
+    SDyn_String string = NULL;
+    ggc_size_t type;
+    long i;
 
-    GGC_PUSH_7(tag, number, string, esm, eim, em, func);
+    GGC_PUSH_6(number, esm, eim, em, func, string);
 
     /* first push them to the global pointer stack */
     pushGlobals();
 
-    /* now for each type, create a type tag and write that as the user pointer */
+    /* now for each type, write the type as the descriptor's user data */
 
     /* undefined */
-    tag = GGC_NEW(SDyn_Tag);
-    GGC_WD(tag, type, SDYN_TYPE_BOXED_UNDEFINED);
+    type = SDYN_TYPE_BOXED_UNDEFINED;
     sdyn_undefined = GGC_NEW(SDyn_Undefined);
-    GGC_WUP(sdyn_undefined, tag);
+    GGC_WUD(sdyn_undefined, type);
 
     /* boolean */
-    tag = GGC_NEW(SDyn_Tag);
-    GGC_WD(tag, type, SDYN_TYPE_BOXED_BOOL);
+    type = SDYN_TYPE_BOXED_BOOL;
     sdyn_false = GGC_NEW(SDyn_Boolean);
-    GGC_WUP(sdyn_false, tag);
+    GGC_WUD(sdyn_false, type);
     sdyn_true = GGC_NEW(SDyn_Boolean);
     GGC_WD(sdyn_true, value, 1);
 
     /* number */
-    tag = GGC_NEW(SDyn_Tag);
-    GGC_WD(tag, type, SDYN_TYPE_BOXED_INT);
+    type = SDYN_TYPE_BOXED_INT;
     number = GGC_NEW(SDyn_Number);
-    GGC_WUP(number, tag);
+    GGC_WUD(number, type);
+    sdyn_smallInts = GGC_NEW_PA(SDyn_Number, SDYN_SMALL_INTS);
+    for (i = 0; i < SDYN_SMALL_INTS; i++) {
+        number = GGC_NEW(SDyn_Number);
+        GGC_WD(number, value, i);
+        GGC_WAP(sdyn_smallInts, i, number);
+    }
 
-    /* string */
-    tag = GGC_NEW(SDyn_Tag);
-    GGC_WD(tag, type, SDYN_TYPE_STRING);
-    string = GGC_NEW(SDyn_String);
-    GGC_WUP(string, tag);
+    /* string (tagged as their descriptors are made, in sdyn_newString) */
+    stringDescriptors = GGC_NEW_PA(GGC_voidp, SDYN_STRING_DESCRIPTORS);
+    constantStrings = GGC_NEW_PA(SDyn_String, SDYN_CSTR_COUNT);
+    for (i = 0; i < SDYN_CSTR_COUNT; i++) {
+        string = sdyn_boxString(NULL, (char *) constantStringValues[i],
+            strlen(constantStringValues[i]));
+        GGC_WAP(constantStrings, i, string);
+    }
 
-    /* the empty shape */
-    sdyn_emptyShape = GGC_NEW(SDyn_Shape);
+    /* the empty shape. Shapes are never forgotten, so they're permanent */
+    sdyn_emptyShape = GGC_NEW_PERMANENT(SDyn_Shape);
     esm = GGC_NEW(SDyn_ShapeMap);
     eim = GGC_NEW(SDyn_IndexMap);
     GGC_WP(sdyn_emptyShape, children, esm);
     GGC_WP(sdyn_emptyShape, members, eim);
 
     /* object */
-    tag = GGC_NEW(SDyn_Tag);
-    GGC_WD(tag, type, SDYN_TYPE_OBJECT);
+    type = SDYN_TYPE_OBJECT;
     sdyn_globalObject = GGC_NEW(SDyn_Object);
-    GGC_WUP(sdyn_globalObject, tag);
+    GGC_WUD(sdyn_globalObject, type);
     GGC_WP(sdyn_globalObject, shape, sdyn_emptyShape);
     em = GGC_NEW_PA(SDyn_Undefined, 0);
     GGC_WP(sdyn_globalObject, members, em);
 
     /* function */
-    tag = GGC_NEW(SDyn_Tag);
-    GGC_WD(tag, type, SDYN_TYPE_FUNCTION);
+    type = SDYN_TYPE_FUNCTION;
     func = GGC_NEW(SDyn_Function);
-    GGC_WUP(func, tag);
+    GGC_WUD(func, type);
 
     /* so long as we're at it, initialize our pointer stack */
 #define POINTER_STACK_SZ 8388608
@@ -210,26 +289,69 @@ SDyn_Number sdyn_boxInt(void **pstack, long value)
     PSTACK();
     GGC_PUSH_1(ret);
 
+    if (value >= 0 && value < SDYN_SMALL_INTS)
+        return GGC_RAP(sdyn_smallInts, value);
+
     ret = GGC_NEW(SDyn_Number);
     GGC_WD(ret, value, value);
 
     return ret;
 }
 
+/* allocate a flat string with room for len characters */
+SDyn_String sdyn_newString(size_t len)
+{
+    struct GGGGC_Descriptor *descriptor = NULL;
+    SDyn_String ret = NULL;
+    size_t size, pWords;
+    ggc_size_t *pointers, type;
+
+    GGC_PUSH_2(descriptor, ret);
+
+    /* figure out how many words we need. The characters start at a__data,
+     * and the struct's own size would count its trailing padding */
+    size = (offsetof(struct SDyn_String__ggggc_struct, a__data) + len + sizeof(ggc_size_t) - 1) /
+        sizeof(ggc_size_t);
+
+    /* get a descriptor of that size */
+    if (size < SDYN_STRING_DESCRIPTORS)
+        descriptor = (struct GGGGC_Descriptor *) GGC_RAP(stringDescriptors, size);
+    if (!descriptor) {
+        /* only the first word of the layout has pointers, but long strings
+         * need more than one word to describe */
+        pWords = GGGGC_DESCRIPTOR_WORDS_REQ(size);
+        pointers = (ggc_size_t *) alloca(pWords * sizeof(ggc_size_t));
+        memset(pointers, 0, pWords * sizeof(ggc_size_t));
+        pointers[0] = 0
+            GGC_PTR(SDyn_String, left)
+            GGC_PTR(SDyn_String, right);
+        /* the ones we keep are permanent */
+        if (size < SDYN_STRING_DESCRIPTORS)
+            descriptor = ggggc_allocatePermanentDescriptorL(size, pointers);
+        else
+            descriptor = ggggc_allocateDescriptorL(size, pointers);
+        type = SDYN_TYPE_STRING;
+        GGGGC_WD(descriptor, user__data, type);
+        if (size < SDYN_STRING_DESCRIPTORS)
+            GGC_WAP(stringDescriptors, size, descriptor);
+    }
+
+    ret = (SDyn_String) ggggc_malloc(descriptor);
+    GGC_WD(ret, length, len);
+
+    return ret;
+}
+
 /* simple boxer for strings */
 SDyn_String sdyn_boxString(void **pstack, char *value, size_t len)
 {
     SDyn_String ret = NULL;
-    GGC_char_Array arr = NULL;
 
     PSTACK();
-    GGC_PUSH_2(ret, arr);
-
-    arr = GGC_NEW_DA(char, len);
-    strncpy(arr->a__data, value, len);
+    GGC_PUSH_1(ret);
 
-    ret = GGC_NEW(SDyn_String);
-    GGC_WP(ret, value, arr);
+    ret = sdyn_newString(len);
+    strncpy(ret->a__data, value, len);
 
     return ret;
 }
@@ -238,22 +360,21 @@ SDyn_String sdyn_boxString(void **pstack, char *value, size_t len)
 SDyn_String sdyn_unquote(SDyn_String istr)
 {
     SDyn_String ret = NULL;
-    GGC_char_Array ia = NULL, reta = NULL;
     size_t i, o;
 
-    GGC_PUSH_4(istr, ret, ia, reta);
+    GGC_PUSH_2(istr, ret);
 
-    ia = GGC_RP(istr, value);
-    reta = GGC_NEW_DA(char, ia->length);
+    istr = sdyn_flattenString(istr);
+    ret = sdyn_newString(GGC_RD(istr, length));
 
     /* just look for escapes */
     for (i = 1, o = 0;
-         i < ia->length - 1;
+         i < GGC_RD(istr, length) - 1;
          i++) {
-        char co = GGC_RAD(ia, i);
+        char co = GGC_RAD(istr, i);
         if (co == '\\') {
             /* an escape */
-            co = GGC_RAD(ia, i);
+            co = GGC_RAD(istr, i);
             i++;
             switch (co) {
                 case 'n':
@@ -267,14 +388,114 @@ SDyn_String sdyn_unquote(SDyn_String istr)
 
         }
 
-        GGC_WAD(reta, o, co);
+        GGC_WAD(ret, o, co);
         o++;
     }
-    reta->length = o;
+    GGC_WD(ret, length, o);
 
-    /* then box it up */
-    ret = GGC_NEW(SDyn_String);
-    GGC_WP(ret, value, reta);
+    return ret;
+}
+
+/* strings shorter than this are concatenated eagerly, since a rope node
+ * wouldn't save anything over just copying them */
+#define SDYN_ROPE_MIN 32
+
+/* concatenate two strings */
+SDyn_String sdyn_concat(void **pstack, SDyn_String left, SDyn_String right)
+{
+    SDyn_String ret = NULL;
+    size_t llen, rlen, len;
+
+    PSTACK();
+    GGC_PUSH_3(left, right, ret);
+
+    llen = GGC_RD(left, length);
+    rlen = GGC_RD(right, length);
+    if (llen == 0) return right;
+    if (rlen == 0) return left;
+
+    len = llen + rlen;
+    if (len < SDYN_ROPE_MIN) {
+        /* short enough to copy now */
+        left = sdyn_flattenString(left);
+        right = sdyn_flattenString(right);
+        ret = sdyn_newString(len);
+        memcpy(ret->a__data, left->a__data, llen);
+        memcpy(ret->a__data + llen, right->a__data, rlen);
+
+    } else {
+        /* make a rope, to be flattened when needed */
+        ret = sdyn_newString(0);
+        GGC_WD(ret, length, len);
+        GGC_WP(ret, left, left);
+        GGC_WP(ret, right, right);
+
+    }
+
+    return ret;
+}
+
+/* get a flat version of a string */
+SDyn_String sdyn_flattenString(SDyn_String str)
+{
+    SDyn_String ret = NULL, node = NULL, part = NULL;
+    SDyn_String *stack;
+    size_t stackSz, stackUsed, pos;
+
+    GGC_PUSH_4(str, ret, node, part);
+
+    /* already flat, or already flattened */
+    ret = GGC_RP(str, left);
+    if (!ret) return str;
+    if (!GGC_RP(str, right)) return ret;
+
+    /* allocate the whole string first, so nothing below can collect */
+    pos = GGC_RD(str, length);
+    ret = sdyn_newString(pos);
+
+    /* ropes built in loops are arbitrarily deep, so rather than recursing, we
+     * fill the array from the right and keep the left branches we've yet to
+     * visit on an explicit stack */
+    stackSz = 16;
+    stackUsed = 0;
+    stack = (SDyn_String *) malloc(stackSz * sizeof(SDyn_String));
+    if (stack == NULL) {
+        perror("malloc");
+        abort();
+    }
+    node = str;
+    while (1) {
+        part = node;
+        if (GGC_RP(node, left) && !GGC_RP(node, right))
+            part = GGC_RP(node, left);
+
+        if (!GGC_RP(part, left)) {
+            /* a flat piece */
+            pos -= GGC_RD(part, length);
+            memcpy(ret->a__data + pos, part->a__data, GGC_RD(part, length));
+            if (stackUsed == 0) break;
+            node = stack[--stackUsed];
+
+        } else {
+            /* a rope node */
+            if (stackUsed >= stackSz) {
+                stackSz *= 2;
+                stack = (SDyn_String *) realloc(stack, stackSz * sizeof(SDyn_String));
+                if (stack == NULL) {
+                    perror("realloc");
+                    abort();
+                }
+            }
+            stack[stackUsed++] = GGC_RP(node, left);
+            node = GGC_RP(node, right);
+
+        }
+    }
+    free(stack);
+
+    /* this string is now flattened, and its pieces may be collected */
+    GGC_WP(str, left, ret);
+    GGC_WP(str, right, GGC_NULL);
 
     return ret;
 }
@@ -282,16 +503,15 @@ SDyn_String sdyn_unquote(SDyn_String istr)
 /* coerce to boolean */
 int sdyn_toBoolean(void **pstack, SDyn_Undefined value)
 {
-    SDyn_Tag tag = NULL;
+    int type;
     SDyn_Boolean boolean = NULL;
     SDyn_Number number = NULL;
     SDyn_String string = NULL;
+    GGC_NO_GC();
+    (void) pstack;
 
-    PSTACK();
-    GGC_PUSH_5(value, tag, boolean, number, string);
-
-    tag = (SDyn_Tag) GGC_RUP(value);
-    switch (GGC_RD(tag, type)) {
+    type = SDYN_BOXED_TYPE(value);
+    switch (type) {
         case SDYN_TYPE_BOXED_BOOL:
             boolean = (SDyn_Boolean) value;
             return GGC_RD(boolean, value);
@@ -305,27 +525,24 @@ int sdyn_toBoolean(void **pstack, SDyn_Undefined value)
 
         case SDYN_TYPE_STRING:
             string = (SDyn_String) value;
-            return (GGC_RP(string, value)->length) ? 1 : 0;
+            return GGC_RD(string, length) ? 1 : 0;
 
         default:
             return 1;
     }
 }
 
-/* coerce to number */
-long sdyn_toNumber(void **pstack, SDyn_Undefined value)
+/* coerce to number a value which isn't an unflattened rope */
+static long toNumberLeaf(SDyn_Undefined value)
 {
-    SDyn_Tag tag = NULL;
+    int type;
     SDyn_Number number = NULL;
     SDyn_Boolean boolean = NULL;
     SDyn_String string = NULL;
-    GGC_char_Array strRaw = NULL;
+    GGC_NO_GC();
 
-    PSTACK();
-    GGC_PUSH_6(value, tag, number, boolean, string, strRaw);
-
-    tag = (SDyn_Tag) GGC_RUP(value);
-    switch (GGC_RD(tag, type)) {
+    type = SDYN_BOXED_TYPE(value);
+    switch (type) {
         case SDYN_TYPE_BOXED_INT:
             number = (SDyn_Number) value;
             return GGC_RD(number, value);
@@ -343,15 +560,16 @@ long sdyn_toNumber(void **pstack, SDyn_Undefined value)
             size_t i;
             long val = 0;
             int sign = 1;
-            string = (SDyn_String) value;
-            strRaw = GGC_RP(string, value);
+            string = flatString((SDyn_String) value);
             i = 0;
-            if (GGC_RAD(strRaw, 0) == '-') {
+            /* an empty string has no character 0 to look at */
+            if (GGC_RD(string, length) == 0) return 0;
+            if (GGC_RAD(string, 0) == '-') {
                 sign = -1;
                 i++;
-            } else if (GGC_RAD(strRaw, 0) == '+') i++;
-            for (; i < strRaw->length; i++) {
-                char c = GGC_RAD(strRaw, i);
+            } else if (GGC_RAD(string, 0) == '+') i++;
+            for (; i < GGC_RD(string, length); i++) {
+                char c = GGC_RAD(string, i);
                 if (c >= '0' && c <= '9') {
                     val *= 10;
                     val += (c - '0');
@@ -365,45 +583,47 @@ long sdyn_toNumber(void **pstack, SDyn_Undefined value)
     }
 }
 
+/* coerce to number */
+long sdyn_toNumber(void **pstack, SDyn_Undefined value)
+{
+    int type = SDYN_BOXED_TYPE(value);
+
+    /* only a rope needs to allocate, to be flattened */
+    if (type == SDYN_TYPE_STRING && !flatString((SDyn_String) value)) {
+        PSTACK();
+        value = (SDyn_Undefined) sdyn_flattenString((SDyn_String) value);
+    }
+
+    return toNumberLeaf(value);
+}
+
 /* coerce to string */
 SDyn_String sdyn_toString(void **pstack, SDyn_Undefined value)
 {
-    SDyn_Tag tag = NULL;
+    int type;
     SDyn_String ret = NULL;
-    GGC_char_Array ca = NULL;
     SDyn_Boolean boolean = NULL;
     SDyn_Number number = NULL;
 
     PSTACK();
-    GGC_PUSH_6(value, tag, ret, ca, boolean, number);
+    GGC_PUSH_4(value, ret, boolean, number);
 
-    tag = (SDyn_Tag) GGC_RUP(value);
-    switch (GGC_RD(tag, type)) {
+    type = SDYN_BOXED_TYPE(value);
+    switch (type) {
         case SDYN_TYPE_STRING:
             return (SDyn_String) value;
 
         case SDYN_TYPE_BOXED_UNDEFINED:
-        {
-            static const char sundefined[] = "undefined";
-            ca = GGC_NEW_DA(char, sizeof(sundefined)-1);
-            memcpy(ca->a__data, sundefined, sizeof(sundefined)-1);
+            ret = GGC_RAP(constantStrings, SDYN_CSTR_UNDEFINED);
             break;
-        }
 
         case SDYN_TYPE_BOXED_BOOL:
-        {
-            static const char strue[] = "true";
-            static const char sfalse[] = "false";
             boolean = (SDyn_Boolean) value;
-            if (GGC_RD(boolean, value)) {
-                ca = GGC_NEW_DA(char, sizeof(strue)-1);
-                memcpy(ca->a__data, strue, sizeof(strue)-1);
-            } else {
-                ca = GGC_NEW_DA(char, sizeof(sfalse)-1);
-                memcpy(ca->a__data, sfalse, sizeof(sfalse)-1);
-            }
+            if (GGC_RD(boolean, value))
+                ret = GGC_RAP(constantStrings, SDYN_CSTR_TRUE);
+            else
+                ret = GGC_RAP(constantStrings, SDYN_CSTR_FALSE);
             break;
-        }
 
         case SDYN_TYPE_BOXED_INT:
         {
@@ -426,65 +646,49 @@ SDyn_String sdyn_toString(void **pstack, SDyn_Undefined value)
             else for (; tmp; len++) tmp /= 10;
 
             /* now allocate that length */
-            ca = GGC_NEW_DA(char, len);
+            ret = sdyn_newString(len);
 
             /* and convert */
             for (len--; len > 0; len--) {
                 char c = (val % 10) + '0';
-                GGC_WAD(ca, len, c);
+                GGC_WAD(ret, len, c);
                 val /= 10;
             }
             if (negative) {
                 char c = '-';
-                GGC_WAD(ca, 0, c);
+                GGC_WAD(ret, 0, c);
             } else {
                 char c = (val % 10) + '0';
-                GGC_WAD(ca, 0, c);
+                GGC_WAD(ret, 0, c);
             }
             break;
         }
 
         case SDYN_TYPE_OBJECT:
-        {
-            static const char sobject[] = "[object Object]";
-            ca = GGC_NEW_DA(char, sizeof(sobject)-1);
-            memcpy(ca->a__data, sobject, sizeof(sobject)-1);
+            ret = GGC_RAP(constantStrings, SDYN_CSTR_OBJECT_OBJECT);
             break;
-        }
 
         case SDYN_TYPE_FUNCTION:
-        {
-            static const char sfunction[] = "[function]";
-            ca = GGC_NEW_DA(char, sizeof(sfunction)-1);
-            memcpy(ca->a__data, sfunction, sizeof(sfunction)-1);
+            ret = GGC_RAP(constantStrings, SDYN_CSTR_FUNCTION_FUNCTION);
             break;
-        }
 
         default:
-        {
-            static const char serror[] = "[ERROR!]";
-            ca = GGC_NEW_DA(char, sizeof(serror)-1);
-            memcpy(ca->a__data, serror, sizeof(serror)-1);
-        }
+            ret = GGC_RAP(constantStrings, SDYN_CSTR_ERROR);
     }
 
-    /* now convert the character array into a string */
-    ret = GGC_NEW(SDyn_String);
-    GGC_WP(ret, value, ca);
-
     return ret;
 }
 
 /* coerce to object (not valid in any meaningful sense, so only required for member access) */
 SDyn_Object sdyn_toObject(void **pstack, SDyn_Undefined value)
 {
-    SDyn_Tag tag = NULL;
+    int type;
 
     PSTACK();
-    GGC_PUSH_2(value, tag);
+    GGC_PUSH_1(value);
 
-    tag = (SDyn_Tag) GGC_RUP(value);
-    if (GGC_RD(tag, type) == SDYN_TYPE_OBJECT) return (SDyn_Object) value;
+    type = SDYN_BOXED_TYPE(value);
+    if (type == SDYN_TYPE_OBJECT) return (SDyn_Object) value;
 
     /* it's not an object, so just give nonsense */
     return sdyn_newObject(NULL);
@@ -493,12 +697,12 @@ SDyn_Object sdyn_toObject(void **pstack, SDyn_Undefined value)
 /* convert to either a string or a number, with preference towards string */
 SDyn_Undefined sdyn_toValue(void **pstack, SDyn_Undefined value)
 {
-    SDyn_Tag tag = NULL;
+    int type;
 
     PSTACK();
-    GGC_PUSH_2(value, tag);
-    tag = (SDyn_Tag) GGC_RUP(value);
-    switch (GGC_RD(tag, type)) {
+    GGC_PUSH_1(value);
+    type = SDYN_BOXED_TYPE(value);
+    switch (type) {
         case SDYN_TYPE_BOXED_INT:
         case SDYN_TYPE_STRING:
             return value;
@@ -511,52 +715,57 @@ SDyn_Undefined sdyn_toValue(void **pstack, SDyn_Undefined value)
 /* assertions */
 SDyn_Function sdyn_assertFunction(void **pstack, SDyn_Function func)
 {
-    SDyn_Tag tag = NULL;
-
-    PSTACK();
-    GGC_PUSH_2(func, tag);
+    int type;
+    GGC_NO_GC();
+    (void) pstack;
 
-    tag = (SDyn_Tag) GGC_RUP(func);
-    if (GGC_RD(tag, type) != SDYN_TYPE_FUNCTION) {
-        fprintf(stderr, "Attempt to call a non-function (type %d)!\n", GGC_RD(tag, type));
+    type = SDYN_BOXED_TYPE(func);
+    if (type != SDYN_TYPE_FUNCTION) {
+        fprintf(stderr, "Attempt to call a non-function (type %d)!\n", type);
         abort();
     }
 
     return func;
 }
 
+/* name a type, as typeof would */
+const char *sdyn_typeName(int type)
+{
+    switch (type) {
+        case SDYN_TYPE_BOXED_UNDEFINED: return "undefined";
+        case SDYN_TYPE_BOXED_BOOL:      return "boolean";
+        case SDYN_TYPE_BOXED_INT:       return "number";
+        case SDYN_TYPE_STRING:          return "string";
+        case SDYN_TYPE_OBJECT:          return "object";
+        case SDYN_TYPE_FUNCTION:        return "function";
+        default:                        return "untagged";
+    }
+}
+
 /* the typeof operation */
 SDyn_String sdyn_typeof(void **pstack, SDyn_Undefined value)
 {
-    SDyn_Tag tag = NULL;
-    GGC_char_Array reta = NULL;
+    int type;
     SDyn_String ret = NULL;
+    GGC_NO_GC();
+    (void) pstack;
 
-    PSTACK();
-    GGC_PUSH_4(value, tag, reta, ret);
-
-    tag = (SDyn_Tag) GGC_RUP(value);
+    type = SDYN_BOXED_TYPE(value);
 
-    /* macro to load a string into GGC */
-#define LSTR(str) do { \
-    reta = GGC_NEW_DA(char, sizeof(str)-1); \
-    memcpy(reta->a__data, str, sizeof(str)-1); \
-} while(0)
+    /* macro to load a constant string */
+#define LSTR(str) ret = GGC_RAP(constantStrings, SDYN_CSTR_ ## str)
 
     /* make our string return */
-    switch (GGC_RD(tag, type)) {
-        case SDYN_TYPE_BOXED_UNDEFINED: LSTR("undefined"); break;
-        case SDYN_TYPE_BOXED_BOOL:      LSTR("boolean"); break;
-        case SDYN_TYPE_BOXED_INT:       LSTR("number"); break;
-        case SDYN_TYPE_STRING:          LSTR("string"); break;
-        case SDYN_TYPE_OBJECT:          LSTR("object"); break;
-        case SDYN_TYPE_FUNCTION:        LSTR("function"); break;
-        default:                        LSTR("???"); break;
+    switch (type) {
+        case SDYN_TYPE_BOXED_UNDEFINED: LSTR(UNDEFINED); break;
+        case SDYN_TYPE_BOXED_BOOL:      LSTR(BOOLEAN); break;
+        case SDYN_TYPE_BOXED_INT:       LSTR(NUMBER); break;
+        case SDYN_TYPE_STRING:          LSTR(STRING); break;
+        case SDYN_TYPE_OBJECT:          LSTR(OBJECT); break;
+        case SDYN_TYPE_FUNCTION:        LSTR(FUNCTION); break;
+        default:                        LSTR(UNKNOWN); break;
     }
-
-    /* and box it */
-    ret = GGC_NEW(SDyn_String);
-    GGC_WP(ret, value, reta);
+#undef LSTR
 
     return ret;
 }
@@ -575,6 +784,9 @@ size_t sdyn_getObjectMemberIndex(void **pstack, SDyn_Object object, SDyn_String
     GGC_PUSH_9(object, member, shape, cshape, shapeChildren, shapeMembers,
         oldObjectMembers, newObjectMembers, indexBox);
 
+    /* member names are hashed and compared repeatedly, so flatten up front */
+    member = sdyn_flattenString(member);
+
     shape = GGC_RP(object, shape);
 
     /* first check if it already exists */
@@ -605,7 +817,7 @@ size_t sdyn_getObjectMemberIndex(void **pstack, SDyn_Object object, SDyn_String
     }
 
     /* nope. Make the new shape */
-    cshape = GGC_NEW(SDyn_Shape);
+    cshape = GGC_NEW_PERMANENT(SDyn_Shape);
     SDyn_ShapeMapPut(shapeChildren, member, cshape);
     ret++;
     GGC_WD(cshape, size, ret);
@@ -639,6 +851,31 @@ SDyn_Undefined sdyn_getObjectMember(void **pstack, SDyn_Object object, SDyn_Stri
         return sdyn_undefined;
 }
 
+/* get a member of an object by a flat name, without allocating */
+SDyn_Undefined sdyn_getObjectMemberLeaf(void **pstack, SDyn_Object object, SDyn_String member)
+{
+    SDyn_IndexMap shapeMembers;
+    SDyn_IndexMapEntry entry;
+    SDyn_String key;
+    size_t size;
+    GGC_NO_GC();
+    (void) pstack;
+
+    /* this is SDyn_IndexMapGet, but keys are always flat */
+    shapeMembers = GGC_RP(GGC_RP(object, shape), members);
+    size = GGC_RD(shapeMembers, size);
+    if (size == 0) return sdyn_undefined;
+    entry = GGC_RAP(GGC_RP(shapeMembers, entries), flatHash(member) % size);
+    while (entry) {
+        key = GGC_RP(entry, key);
+        if (key && flatCmp(member, key) == 0)
+            return GGC_RAP(GGC_RP(object, members), GGC_RD(GGC_RP(entry, value), v));
+        entry = GGC_RP(entry, next);
+    }
+
+    return sdyn_undefined;
+}
+
 /* set or add a member on/to an object */
 void sdyn_setObjectMember(void **pstack, SDyn_Object object, SDyn_String member, SDyn_Undefined value)
 {
@@ -658,19 +895,14 @@ void sdyn_setObjectMember(void **pstack, SDyn_Object object, SDyn_String member,
 /* the ever-complicated add function */
 SDyn_Undefined sdyn_add(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
 {
-    SDyn_Tag ltag = NULL, rtag = NULL;
     SDyn_Number ln = NULL, rn = NULL;
-    SDyn_String ls = NULL, rs = NULL, rets = NULL;
-    GGC_char_Array lsa = NULL, rsa = NULL, retsa = NULL;
+    SDyn_String ls = NULL, rs = NULL;
 
     PSTACK();
-    GGC_PUSH_12(left, right, ltag, rtag, ln, rn, ls, rs, rets, lsa, rsa, retsa);
-
-    ltag = (SDyn_Tag) GGC_RUP(left);
-    rtag = (SDyn_Tag) GGC_RUP(right);
+    GGC_PUSH_6(left, right, ln, rn, ls, rs);
 
     /* only if both are numbers do we add them as numbers */
-    if (GGC_RD(ltag, type) == SDYN_TYPE_BOXED_INT && GGC_RD(rtag, type) == SDYN_TYPE_BOXED_INT) {
+    if (SDYN_BOXED_TYPE(left) == SDYN_TYPE_BOXED_INT && SDYN_BOXED_TYPE(right) == SDYN_TYPE_BOXED_INT) {
         long retv;
         ln = (SDyn_Number) left;
         rn = (SDyn_Number) right;
@@ -681,21 +913,43 @@ SDyn_Undefined sdyn_add(void **pstack, SDyn_Undefined left, SDyn_Undefined right
     /* need to convert to strings */
     ls = sdyn_toString(NULL, left);
     rs = sdyn_toString(NULL, right);
-    lsa = GGC_RP(ls, value);
-    rsa = GGC_RP(rs, value);
 
     /* and concatenate them */
-    retsa = GGC_NEW_DA(char, lsa->length + rsa->length);
-    memcpy(retsa->a__data, lsa->a__data, lsa->length);
-    memcpy(retsa->a__data + lsa->length, rsa->a__data, rsa->length);
-    rets = GGC_NEW(SDyn_String);
-    GGC_WP(rets, value, retsa);
+    return (SDyn_Undefined) sdyn_concat(NULL, ls, rs);
+}
+
+/* the cases of equality which need no allocation: 1 or 0 if it could tell,
+ * or -1 if equalSlow must */
+static int equalLeaf(SDyn_Undefined left, SDyn_Undefined right)
+{
+    SDyn_String lstr, rstr;
+    int ltagv, rtagv;
+    GGC_NO_GC();
+
+    ltagv = SDYN_BOXED_TYPE(left);
+    rtagv = SDYN_BOXED_TYPE(right);
+    if (ltagv != rtagv) return -1;
+
+    switch (ltagv) {
+        case SDYN_TYPE_BOXED_INT:
+            return (GGC_RD((SDyn_Number) left, value) == GGC_RD((SDyn_Number) right, value));
 
-    return (SDyn_Undefined) rets;
+        case SDYN_TYPE_STRING:
+            lstr = (SDyn_String) left;
+            rstr = (SDyn_String) right;
+            if (GGC_RD(lstr, length) != GGC_RD(rstr, length)) return 0;
+            lstr = flatString(lstr);
+            rstr = flatString(rstr);
+            if (!lstr || !rstr) return -1;
+            return (memcmp(lstr->a__data, rstr->a__data, GGC_RD(lstr, length)) == 0);
+
+        default:
+            return (left == right);
+    }
 }
 
 /* and the even-more-complicated equals function */
-int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
+static int equalSlow(SDyn_Undefined left, SDyn_Undefined right)
 {
     /* Defined in ES5 as follows (reduced to eliminate types/values/conversions not relevant to SDyn):
      *
@@ -738,19 +992,14 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
      * Return false.
      */
 
-    SDyn_Tag ltag = NULL, rtag = NULL;
     SDyn_Number lnum = NULL, rnum = NULL;
     SDyn_String lstr = NULL, rstr = NULL;
-    GGC_char_Array lstra = NULL, rstra = NULL;
     int ltagv, rtagv;
 
-    PSTACK();
-    GGC_PUSH_10(left, right, ltag, rtag, lnum, rnum, lstr, rstr, lstra, rstra);
+    GGC_PUSH_6(left, right, lnum, rnum, lstr, rstr);
 
-    ltag = (SDyn_Tag) GGC_RUP(left);
-    rtag = (SDyn_Tag) GGC_RUP(right);
-    ltagv = GGC_RD(ltag, type);
-    rtagv = GGC_RD(rtag, type);
+    ltagv = SDYN_BOXED_TYPE(left);
+    rtagv = SDYN_BOXED_TYPE(right);
     retry:
 
     /* first check if they're the same type */
@@ -771,15 +1020,15 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
 
                 lstr = (SDyn_String) left;
                 rstr = (SDyn_String) right;
-                lstra = GGC_RP(lstr, value);
-                rstra = GGC_RP(rstr, value);
 
                 /* first off, if they're not the same length, they can't be equal */
-                if (lstra->length != rstra->length) return 0;
+                if (GGC_RD(lstr, length) != GGC_RD(rstr, length)) return 0;
+                lstr = sdyn_flattenString(lstr);
+                rstr = sdyn_flattenString(rstr);
 
                 /* look for differences */
-                for (i = 0; i < lstra->length; i++) {
-                    if (GGC_RAD(lstra, i) != GGC_RAD(rstra, i)) return 0;
+                for (i = 0; i < GGC_RD(lstr, length); i++) {
+                    if (GGC_RAD(lstr, i) != GGC_RAD(rstr, i)) return 0;
                 }
 
                 /* identical */
@@ -830,6 +1079,14 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
     return 0;
 }
 
+int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
+{
+    int ret = equalLeaf(left, right);
+    if (ret >= 0) return ret;
+    PSTACK();
+    return equalSlow(left, right);
+}
+
 /* assert that a function is compiled */
 sdyn_native_function_t sdyn_assertCompiled(void **pstack, SDyn_Function func)
 {
@@ -849,6 +1106,8 @@ sdyn_native_function_t sdyn_assertCompiled(void **pstack, SDyn_Function func)
             GGC_WP(func, irValue, ir);
         }
 
+        if (sdyn_allocProfiling)
+            sdyn_allocProfileFunction(GGC_RP(func, ast));
         nfunc = sdyn_compile(ir);
         GGC_WD(func, value, nfunc);
     }
@@ -860,11 +1119,30 @@ sdyn_native_function_t sdyn_assertCompiled(void **pstack, SDyn_Function func)
 SDyn_Undefined sdyn_call(void **pstack, SDyn_Function func, size_t argCt, SDyn_Undefined *args)
 {
     sdyn_native_function_t nfunc;
+    void **callerStack;
+    size_t callerSite;
+    SDyn_Undefined ret;
 
     PSTACK();
     GGC_PUSH_1(func);
 
     nfunc = sdyn_assertCompiled(NULL, func);
 
-    return nfunc(ggc_jitPointerStack, argCt, args);
+    /* a call is as good a time as any for a snapshot SIGUSR2 asked for */
+    if (sdyn_heapSnapshotRequested) {
+        sdyn_heapSnapshotRequested = 0;
+        sdyn_heapSnapshotFile(NULL);
+    }
+
+    /* the GC walks the pointer stack frame by frame, so once the callee's
+     * frames are gone, it mustn't be left pointing at them */
+    callerStack = ggc_jitPointerStack;
+    callerSite = sdyn_allocSite;
+    ret = nfunc(callerStack, argCt, args);
+    ggc_jitPointerStack = callerStack;
+
+    /* and what the caller allocates from here on is its own again, not the
+     * callee's last site's (or, from C, charged to C) */
+    sdyn_allocSite = callerSite;
+    return ret;
 }